@@ -0,0 +1,336 @@
+#include "bitmap.h"
+
+void bitmap_write(struct s_superblock* sb, int fd, uint32_t blocks_used)
+{
+    uint32_t cells = (blocks_used + BYTE - 1) >> 3;
+    uint8_t* buf = (uint8_t*)malloc(cells);
+
+    memset(buf, 255, cells);
+
+    uint32_t sh = BYTE - mod_base2(blocks_used, BYTE);
+    if (sh < BYTE)
+        buf[cells - 1] = (buf[cells - 1] >> sh) << sh;
+
+    io_pwrite(sb, fd, buf, cells, sb->bitmap_offset);
+    free(buf);
+}
+
+struct s_bitmap* bitmap_open(struct s_superblock* sb, int fd, uint32_t offset, uint32_t nbits)
+{
+    struct s_bitmap* bm = (struct s_bitmap*)malloc(sizeof(struct s_bitmap));
+
+    bm->ncells = (nbits + BYTE - 1) >> 3;
+
+    // a mapped image is its own bitmap, there is nothing to write back
+    bm->cells = io_get_ptr(sb, offset);
+    bm->mapped = (bm->cells != NULL);
+
+    if (!bm->mapped)
+    {
+        bm->cells = (uint8_t*)malloc(bm->ncells);
+        io_pread(sb, fd, bm->cells, bm->ncells, offset);
+    }
+
+    uint32_t sh = mod_base2(nbits, BYTE);
+    if (sh)
+        bm->cells[bm->ncells - 1] |= 255 >> sh;
+
+    bm->hint = 0;
+
+    bm->nchunks = (bm->ncells + BITMAP_CHUNK - 1) / BITMAP_CHUNK;
+    bm->dirty = (uint8_t*)calloc(bm->nchunks, sizeof(uint8_t));
+
+    return bm;
+}
+
+void bitmap_close(struct s_bitmap* bm)
+{
+    if (!bm->mapped)
+        free(bm->cells);
+    free(bm->dirty);
+    free(bm);
+}
+
+void bitmap_load(struct s_superblock* sb, int fd)
+{
+    sb->bitmap = bitmap_open(sb, fd, sb->bitmap_offset, sb->blocks_total);
+    sb->inode_bitmap = bitmap_open(sb, fd, sb->inode_bitmap_offset, sb->inodes_total);
+}
+
+void bitmap_flush_cells(struct s_superblock* sb, int fd, struct s_bitmap* bm, uint32_t offset)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < bm->nchunks; i = j)
+    {
+        if (!bm->dirty[i])
+        {
+            j = i + 1;
+            continue;
+        }
+
+        for (j = i; j < bm->nchunks && bm->dirty[j]; ++j)
+            bm->dirty[j] = 0;
+
+        uint32_t from = i * BITMAP_CHUNK;
+        uint32_t to = j * BITMAP_CHUNK;
+        if (to > bm->ncells)
+            to = bm->ncells;
+
+        if (!bm->mapped)
+            cache_pwrite(sb, fd, bm->cells + from, to - from, offset + from);
+    }
+}
+
+void bitmap_flush(struct s_superblock* sb, int fd)
+{
+    bitmap_flush_cells(sb, fd, sb->bitmap, sb->bitmap_offset);
+    bitmap_flush_cells(sb, fd, sb->inode_bitmap, sb->inode_bitmap_offset);
+}
+
+void bitmap_unload(struct s_superblock* sb)
+{
+    if (sb->bitmap == NULL)
+        return;
+
+    bitmap_close(sb->bitmap);
+    bitmap_close(sb->inode_bitmap);
+
+    sb->bitmap = NULL;
+    sb->inode_bitmap = NULL;
+}
+
+uint8_t bitmap_block_is_unavailable(struct s_superblock* sb, int fd, uint32_t nblock)
+{
+    if (nblock >= sb->blocks_total)
+        return 1;
+
+    uint8_t cell = sb->bitmap->cells[nblock >> 3];
+    uint8_t r = mod_base2(nblock, BYTE);
+
+    return cell & (1 << (BYTE - r - 1));
+}
+
+uint64_t bitmap_get_word(struct s_bitmap* bm, uint32_t nword)
+{
+    uint64_t word = ~0ULL;
+    uint32_t from = nword * sizeof(uint64_t);
+    uint32_t len = bm->ncells - from;
+
+    memcpy(&word, bm->cells + from, len < sizeof(uint64_t) ? len : sizeof(uint64_t));
+    return be64toh(word);
+}
+
+uint32_t bitmap_get_available_block(struct s_superblock* sb, int fd)
+{
+    if (sb->blocks_remain == 0)
+        return 0;
+
+    struct s_bitmap* bm = sb->bitmap;
+    uint32_t nwords = (bm->ncells + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    uint32_t i, k;
+    for (i = 0; i < nwords; ++i)
+    {
+        k = bm->hint + i;
+        if (k >= nwords)
+            k -= nwords;
+
+        uint64_t word = ~bitmap_get_word(bm, k);
+        if (word)
+        {
+            bm->hint = k;
+            return (k << 6) + __builtin_clzll(word);
+        }
+    }
+
+    return 0;
+}
+
+uint32_t bitmap_next_block(struct s_bitmap* bm, uint32_t nblock, uint32_t limit, int available)
+{
+    uint32_t nwords = (bm->ncells + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    uint32_t k = nblock >> 6;
+    if (k >= nwords)
+        return limit;
+
+    uint64_t flip = available ? ~0ULL : 0;
+    uint64_t word = (bitmap_get_word(bm, k) ^ flip) & (~0ULL >> mod_base2(nblock, 64));
+
+    while (word == 0)
+    {
+        if (++k >= nwords || (k << 6) >= limit)
+            return limit;
+        word = bitmap_get_word(bm, k) ^ flip;
+    }
+
+    nblock = (k << 6) + __builtin_clzll(word);
+    return nblock < limit ? nblock : limit;
+}
+
+uint32_t bitmap_get_available_extent(struct s_superblock* sb, int fd, uint32_t want, uint32_t* nblock)
+{
+    if (sb->blocks_remain == 0 || want == 0)
+        return 0;
+
+    struct s_bitmap* bm = sb->bitmap;
+    uint32_t from[2] = { bm->hint << 6, 0 };
+    uint32_t to[2] = { sb->blocks_total, bm->hint << 6 };
+    uint32_t pass, start, end, best = 0;
+
+    for (pass = 0; pass < 2; ++pass)
+    {
+        for (start = from[pass]; start < to[pass]; start = end)
+        {
+            start = bitmap_next_block(bm, start, to[pass], 1);
+            if (start == to[pass])
+                break;
+
+            end = bitmap_next_block(bm, start, to[pass], 0);
+            if (end - start >= want)
+            {
+                bm->hint = start >> 6;
+                *nblock = start;
+                return want;
+            }
+
+            if (end - start > best)
+            {
+                best = end - start;
+                *nblock = start;
+            }
+        }
+    }
+
+    return best;
+}
+
+void bitmap_mark_dirty(struct s_bitmap* bm, uint32_t nblock)
+{
+    bm->dirty[(nblock >> 3) / BITMAP_CHUNK] = 1;
+}
+
+void bitmap_set_unavailable(struct s_superblock* sb, int fd, uint32_t nblock)
+{
+    struct s_bitmap* bm = sb->bitmap;
+
+    uint8_t rest = mod_base2(nblock, BYTE);
+    bm->cells[nblock >> 3] |= 1 << (BYTE - rest - 1);
+    bitmap_mark_dirty(bm, nblock);
+
+    --(sb->blocks_remain);
+}
+
+void bitmap_set_available(struct s_superblock* sb, int fd, uint32_t nblock)
+{
+    struct s_bitmap* bm = sb->bitmap;
+
+    uint8_t rest = mod_base2(nblock, BYTE);
+    bm->cells[nblock >> 3] &= ~(1 << (BYTE - rest - 1));
+    bitmap_mark_dirty(bm, nblock);
+
+    cache_invalidate(sb, nblock);
+
+    if ((nblock >> 6) < bm->hint)
+        bm->hint = nblock >> 6;
+
+    ++(sb->blocks_remain);
+}
+
+void bitmap_set_extent_unavailable(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t len)
+{
+    for (; len && mod_base2(nblock, BYTE); --len)
+        bitmap_set_unavailable(sb, fd, nblock++);
+
+    uint32_t cells = len >> 3;
+    if (cells)
+    {
+        struct s_bitmap* bm = sb->bitmap;
+        memset(bm->cells + (nblock >> 3), 255, cells);
+
+        uint32_t i;
+        for (i = 0; i < cells; i += BITMAP_CHUNK)
+            bitmap_mark_dirty(bm, nblock + (i << 3));
+        bitmap_mark_dirty(bm, nblock + ((cells - 1) << 3));
+
+        sb->blocks_remain -= cells << 3;
+        nblock += cells << 3;
+        len -= cells << 3;
+    }
+
+    for (; len; --len)
+        bitmap_set_unavailable(sb, fd, nblock++);
+}
+
+void bitmap_set_extent_available(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t len)
+{
+    for (; len && mod_base2(nblock, BYTE); --len)
+        bitmap_set_available(sb, fd, nblock++);
+
+    uint32_t cells = len >> 3;
+    if (cells)
+    {
+        struct s_bitmap* bm = sb->bitmap;
+        memset(bm->cells + (nblock >> 3), 0, cells);
+
+        uint32_t i;
+        for (i = 0; i < cells; i += BITMAP_CHUNK)
+            bitmap_mark_dirty(bm, nblock + (i << 3));
+        bitmap_mark_dirty(bm, nblock + ((cells - 1) << 3));
+
+        for (i = 0; i < cells << 3; ++i)
+            cache_invalidate(sb, nblock + i);
+
+        if ((nblock >> 6) < bm->hint)
+            bm->hint = nblock >> 6;
+
+        sb->blocks_remain += cells << 3;
+        nblock += cells << 3;
+        len -= cells << 3;
+    }
+
+    for (; len; --len)
+        bitmap_set_available(sb, fd, nblock++);
+}
+
+uint32_t bitmap_get_available_inode(struct s_superblock* sb, int fd)
+{
+    if (sb->inodes_remain == 0)
+        return 0;
+
+    struct s_bitmap* bm = sb->inode_bitmap;
+    uint32_t ninode = bitmap_next_block(bm, bm->hint << 6, sb->inodes_total, 1);
+    if (ninode == sb->inodes_total)
+        ninode = bitmap_next_block(bm, 0, sb->inodes_total, 1);
+
+    if (ninode == sb->inodes_total)
+        return 0;
+
+    bm->hint = ninode >> 6;
+    return ninode;
+}
+
+void bitmap_set_inode_unavailable(struct s_superblock* sb, int fd, uint32_t ninode)
+{
+    struct s_bitmap* bm = sb->inode_bitmap;
+
+    uint8_t rest = mod_base2(ninode, BYTE);
+    bm->cells[ninode >> 3] |= 1 << (BYTE - rest - 1);
+    bitmap_mark_dirty(bm, ninode);
+
+    --(sb->inodes_remain);
+}
+
+void bitmap_set_inode_available(struct s_superblock* sb, int fd, uint32_t ninode)
+{
+    struct s_bitmap* bm = sb->inode_bitmap;
+
+    uint8_t rest = mod_base2(ninode, BYTE);
+    bm->cells[ninode >> 3] &= ~(1 << (BYTE - rest - 1));
+    bitmap_mark_dirty(bm, ninode);
+
+    if ((ninode >> 6) < bm->hint)
+        bm->hint = ninode >> 6;
+
+    ++(sb->inodes_remain);
+}
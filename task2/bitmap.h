@@ -5,111 +5,80 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <memory.h>
+#include <endian.h>
 #include "options.h"
 #include "utils.h"
 #include "assert.h"
 #include "superblock.h"
+#include "cache.h"
+#include "io.h"
 
 #define BYTE 8
-#define BUFSIZE 1024
 
-void bitmap_write(int fd, uint32_t blocks_used, uint32_t blocks_total)
-{
-    uint32_t cells = (blocks_used + BYTE - 1) >> 3;
-    uint32_t rest = (blocks_total >> 3) - cells;
+// Marks the first blocks_used blocks as taken. Only that prefix of the bitmap
+// is written; the rest must already read back as zeros (a fresh sparse
+// image does).
+void bitmap_write(struct s_superblock* sb, int fd, uint32_t blocks_used);
 
-    uint8_t buf[BUFSIZE] = { 255 };
+#define BITMAP_CHUNK 512
 
-    for (; cells >= BUFSIZE; cells -= BUFSIZE)
-        write(fd, buf, sizeof(buf));
+struct s_bitmap
+{
+    uint8_t* cells;
+    uint32_t ncells;
+    uint8_t mapped;
 
-    for (; cells > 1; --cells)
-        write(fd, buf, sizeof(uint8_t));
+    uint32_t hint;
 
-    uint32_t sh = BYTE - mod_base2(blocks_used, BYTE);
-    if (sh < BYTE)
-        buf[0] = (buf[0] >> sh) << sh;
+    uint8_t* dirty;
+    uint32_t nchunks;
+};
 
-    write(fd, buf, sizeof(uint8_t));
+struct s_bitmap* bitmap_open(struct s_superblock* sb, int fd, uint32_t offset, uint32_t nbits);
 
-    memset(buf, 0, sizeof(buf));
-    for (; rest >= BUFSIZE; rest -= BUFSIZE)
-        write(fd, buf, sizeof(buf));
+void bitmap_close(struct s_bitmap* bm);
 
-    for (; rest; --rest)
-        write(fd, buf, sizeof(uint8_t));
-}
+// Loads the block bitmap and the inode bitmap.
+void bitmap_load(struct s_superblock* sb, int fd);
 
-uint32_t bitmap_get_cell_offset(struct s_superblock* sb, int fd, uint32_t nblock)
-{
-    return sizeof(struct s_superblock) + (nblock >> 3);
-}
+void bitmap_flush_cells(struct s_superblock* sb, int fd, struct s_bitmap* bm, uint32_t offset);
 
-uint8_t bitmap_get_cell(struct s_superblock* sb, int fd, uint32_t nblock)
-{
-    uint8_t cell;
-    uint32_t offset = bitmap_get_cell_offset(sb, fd, nblock);
+void bitmap_flush(struct s_superblock* sb, int fd);
 
-    pread(fd, &cell, sizeof(uint8_t), offset);
-    return cell;
-}
+void bitmap_unload(struct s_superblock* sb);
 
-uint8_t bitmap_block_is_unavailable(struct s_superblock* sb, int fd, uint32_t nblock)
-{
-    if (nblock >= sb->blocks_total)
-        return 1;
+uint8_t bitmap_block_is_unavailable(struct s_superblock* sb, int fd, uint32_t nblock);
 
-    uint8_t cell = bitmap_get_cell(sb, fd, nblock);
-    uint8_t r = mod_base2(nblock, BYTE);
+// Cells keep the on-disk MSB-first bit order, so a word loaded big-endian
+// has block 0 as its top bit and the first free block is its leading zero.
+// Bytes past the end of the bitmap read as unavailable.
+uint64_t bitmap_get_word(struct s_bitmap* bm, uint32_t nword);
 
-    return cell & (1 << (BYTE - r - 1));
-}
+uint32_t bitmap_get_available_block(struct s_superblock* sb, int fd);
 
-uint32_t bitmap_get_available_block(struct s_superblock* sb, int fd)
-{
-    if (sb->blocks_remain == 0)
-        return 0;
-
-    uint8_t buf[BUFSIZE];
-    for (int k = sizeof(struct s_superblock); k < (sb->blocks_total >> 3) + sizeof(struct s_superblock); k += sizeof(buf))
-    {
-        pread(fd, buf, sizeof(buf), k);
-        for (int i = 0; i < BUFSIZE; ++i)
-            for (int j = 0; j < BYTE; ++j)
-                if (!get8_bit(buf[i], j))
-                    return ((k - sizeof(struct s_superblock) + i) << 3) + j;
-    }
-}
-
-void bitmap_set_unavailable(struct s_superblock* sb, int fd, uint32_t nblock)
-{
-    uint8_t cell;
-    uint32_t offset = bitmap_get_cell_offset(sb, fd, nblock);
+uint32_t bitmap_next_block(struct s_bitmap* bm, uint32_t nblock, uint32_t limit, int available);
 
-    pread(fd, &cell, sizeof(uint8_t), offset);
+// Next-fit search for want contiguous free blocks starting at the hint.
+// If no run is long enough, the longest one seen is returned instead and
+// the caller asks again for the remainder.
+uint32_t bitmap_get_available_extent(struct s_superblock* sb, int fd, uint32_t want, uint32_t* nblock);
 
-    uint8_t rest = mod_base2(nblock, BYTE);
-    cell |= 1 << (BYTE - rest - 1);
+void bitmap_mark_dirty(struct s_bitmap* bm, uint32_t nblock);
 
-    pwrite(fd, &cell, sizeof(uint8_t), offset);
+void bitmap_set_unavailable(struct s_superblock* sb, int fd, uint32_t nblock);
 
-    --(sb->blocks_remain);
-}
-
-void bitmap_set_available(struct s_superblock* sb, int fd, uint32_t nblock)
-{
-    uint8_t cell;
-    uint32_t offset = bitmap_get_cell_offset(sb, fd, nblock);
+void bitmap_set_available(struct s_superblock* sb, int fd, uint32_t nblock);
 
-    pread(fd, &cell, sizeof(uint8_t), offset);
+void bitmap_set_extent_unavailable(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t len);
 
-    uint8_t rest = mod_base2(nblock, BYTE);
-    cell &= ~(1 << (BYTE - rest - 1));
+void bitmap_set_extent_available(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t len);
 
-    pwrite(fd, &cell, sizeof(uint8_t), offset);
+// Inode numbers index the inode table; inode 0 is reserved at format time so
+// that 0 can stand for "no inode".
+uint32_t bitmap_get_available_inode(struct s_superblock* sb, int fd);
 
-    ++(sb->blocks_remain);
-}
+void bitmap_set_inode_unavailable(struct s_superblock* sb, int fd, uint32_t ninode);
 
+void bitmap_set_inode_available(struct s_superblock* sb, int fd, uint32_t ninode);
 
 #endif // BITMAP_H_INCLUDED
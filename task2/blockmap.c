@@ -0,0 +1,337 @@
+#include "blockmap.h"
+
+uint32_t blockmap_get_fanout(struct s_superblock* sb)
+{
+    return sb->block_size / sizeof(uint32_t);
+}
+
+uint64_t blockmap_get_capacity(struct s_superblock* sb)
+{
+    uint64_t p = blockmap_get_fanout(sb);
+    uint64_t capacity = 12 + p + p * p + p * p * p;
+
+    return capacity < UINT32_MAX ? capacity : UINT32_MAX;
+}
+
+uint32_t blockmap_get_overhead(struct s_superblock* sb, uint32_t n)
+{
+    uint64_t p = blockmap_get_fanout(sb), m, rest = n, overhead = 0;
+
+    if (rest <= 12)
+        return 0;
+    rest -= 12;
+
+    m = rest < p ? rest : p;
+    overhead += 1;
+    rest -= m;
+
+    if (rest)
+    {
+        m = rest < p * p ? rest : p * p;
+        overhead += 1 + (m + p - 1) / p;
+        rest -= m;
+    }
+
+    if (rest)
+        overhead += 1 + (rest + p * p - 1) / (p * p) + (rest + p - 1) / p;
+
+    return overhead;
+}
+
+uint32_t* blockmap_get_root(struct s_superblock* sb, struct s_inode* node, uint32_t i, uint32_t* depth, uint32_t* rest)
+{
+    uint64_t p = blockmap_get_fanout(sb), k = i - 12;
+
+    if (k < p)
+    {
+        *depth = 1;
+        *rest = k;
+        return &node->iblock;
+    }
+
+    k -= p;
+    if (k < p * p)
+    {
+        *depth = 2;
+        *rest = k;
+        return &node->diblock;
+    }
+
+    *depth = 3;
+    *rest = k - p * p;
+    return &node->tiblock;
+}
+
+uint32_t blockmap_get_slot(struct s_superblock* sb, uint32_t rest, uint32_t level)
+{
+    uint32_t p = blockmap_get_fanout(sb);
+    for (; level; --level)
+        rest /= p;
+
+    return rest % p;
+}
+
+uint32_t blockmap_read_ptr(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t slot)
+{
+    uint32_t ptr;
+    cache_pread(sb, fd, &ptr, sizeof(uint32_t), get_block_offset(sb, nblock) + slot * sizeof(uint32_t));
+    return ptr;
+}
+
+void blockmap_write_ptr(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t slot, uint32_t ptr)
+{
+    cache_pwrite(sb, fd, &ptr, sizeof(uint32_t), get_block_offset(sb, nblock) + slot * sizeof(uint32_t));
+}
+
+uint32_t blockmap_get(struct s_superblock* sb, int fd, struct s_inode* node, uint32_t i)
+{
+    if (i < 12)
+        return node->blocks[i];
+
+    uint32_t depth, rest;
+    uint32_t nblock = *blockmap_get_root(sb, node, i, &depth, &rest);
+
+    for (; depth && nblock; --depth)
+        nblock = blockmap_read_ptr(sb, fd, nblock, blockmap_get_slot(sb, rest, depth - 1));
+
+    return nblock;
+}
+
+uint32_t blockmap_new_index(struct s_superblock* sb, int fd, uint32_t** spare)
+{
+    uint32_t nblock;
+    if (spare && **spare)
+        nblock = *((*spare)++);
+    else
+    {
+        nblock = bitmap_get_available_block(sb, fd);
+        bitmap_set_unavailable(sb, fd, nblock);
+    }
+
+    uint8_t* zero = (uint8_t*)calloc(sb->block_size, 1);
+    cache_pwrite(sb, fd, zero, sb->block_size, get_block_offset(sb, nblock));
+    free(zero);
+
+    return nblock;
+}
+
+void blockmap_append(struct s_superblock* sb, int fd, struct s_inode* node, uint32_t nblock, uint32_t** spare)
+{
+    uint32_t i = node->nblocks++;
+    if (i < 12)
+    {
+        node->blocks[i] = nblock;
+        return;
+    }
+
+    uint32_t depth, rest;
+    uint32_t* root = blockmap_get_root(sb, node, i, &depth, &rest);
+
+    if (*root == 0)
+        *root = blockmap_new_index(sb, fd, spare);
+
+    uint32_t index = *root, slot, next;
+    for (; depth > 1; --depth)
+    {
+        slot = blockmap_get_slot(sb, rest, depth - 1);
+        next = blockmap_read_ptr(sb, fd, index, slot);
+        if (next == 0)
+        {
+            next = blockmap_new_index(sb, fd, spare);
+            blockmap_write_ptr(sb, fd, index, slot, next);
+        }
+
+        index = next;
+    }
+
+    blockmap_write_ptr(sb, fd, index, blockmap_get_slot(sb, rest, 0), nblock);
+}
+
+void blockmap_init(struct s_blockmap* it, struct s_superblock* sb, int fd, struct s_inode* node, uint32_t first)
+{
+    it->sb = sb;
+    it->fd = fd;
+    it->node = node;
+    it->i = first;
+
+    it->leaf = (uint32_t*)malloc(sb->block_size);
+    it->leaf_first = 0;
+    it->leaf_block = 0;
+}
+
+void blockmap_del(struct s_blockmap* it)
+{
+    free(it->leaf);
+}
+
+uint32_t blockmap_next(struct s_blockmap* it)
+{
+    struct s_superblock* sb = it->sb;
+    uint32_t i = it->i;
+
+    if (i >= it->node->nblocks)
+        return 0;
+
+    ++(it->i);
+
+    if (i < 12)
+        return it->node->blocks[i];
+
+    uint32_t p = blockmap_get_fanout(sb);
+    if (it->leaf_block == 0 || i < it->leaf_first || i >= it->leaf_first + p)
+    {
+        uint32_t depth, rest;
+        uint32_t nblock = *blockmap_get_root(sb, it->node, i, &depth, &rest);
+
+        for (; depth > 1 && nblock; --depth)
+            nblock = blockmap_read_ptr(sb, it->fd, nblock, blockmap_get_slot(sb, rest, depth - 1));
+
+        if (nblock == 0)
+            return 0;
+
+        cache_pread(sb, it->fd, it->leaf, sb->block_size, get_block_offset(sb, nblock));
+        it->leaf_block = nblock;
+        it->leaf_first = i - rest % p;
+    }
+
+    return it->leaf[i - it->leaf_first];
+}
+
+uint32_t* blockmap_collect(struct s_superblock* sb, int fd, struct s_inode* node)
+{
+    uint32_t i, *blocks = (uint32_t*)malloc((node->nblocks + 1) * sizeof(uint32_t));
+
+    struct s_blockmap it;
+    blockmap_init(&it, sb, fd, node, 0);
+
+    for (i = 0; i < node->nblocks; ++i)
+        blocks[i] = blockmap_next(&it);
+    blocks[i] = 0;
+
+    blockmap_del(&it);
+    return blocks;
+}
+
+void blockmap_free_tree(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t depth)
+{
+    if (nblock == 0)
+        return;
+
+    if (depth > 1)
+    {
+        uint32_t i, p = blockmap_get_fanout(sb);
+        uint32_t* block = (uint32_t*)malloc(sb->block_size);
+
+        cache_pread(sb, fd, block, sb->block_size, get_block_offset(sb, nblock));
+        for (i = 0; i < p; ++i)
+            blockmap_free_tree(sb, fd, block[i], depth - 1);
+
+        free(block);
+    }
+
+    bitmap_set_available(sb, fd, nblock);
+}
+
+void blockmap_free(struct s_superblock* sb, int fd, struct s_inode* node)
+{
+    uint32_t i, j, n = node->nblocks;
+    uint32_t* blocks = blockmap_collect(sb, fd, node);
+
+    for (i = 0; i < n; i = j)
+    {
+        for (j = i + 1; j < n && blocks[j] == blocks[j - 1] + 1; ++j);
+        if (blocks[i])
+            bitmap_set_extent_available(sb, fd, blocks[i], j - i);
+    }
+
+    free(blocks);
+
+    blockmap_free_tree(sb, fd, node->iblock, 1);
+    blockmap_free_tree(sb, fd, node->diblock, 2);
+    blockmap_free_tree(sb, fd, node->tiblock, 3);
+
+    memset(node->blocks, 0, 12 * sizeof(uint32_t));
+    node->iblock = 0;
+    node->diblock = 0;
+    node->tiblock = 0;
+    node->nblocks = 0;
+}
+
+uint32_t blockmap_trim_tree(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t depth, uint64_t first, uint64_t keep)
+{
+    if (nblock == 0)
+        return 0;
+
+    if (keep <= first)
+    {
+        blockmap_free_tree(sb, fd, nblock, depth);
+        return 0;
+    }
+
+    uint64_t p = blockmap_get_fanout(sb), span = 1, i;
+    for (i = 1; i < depth; ++i)
+        span *= p;
+
+    if (keep >= first + span * p)
+        return nblock;
+
+    if (depth == 1)
+    {
+        uint32_t slot = keep - first;
+        uint8_t* zero = (uint8_t*)calloc(p - slot, sizeof(uint32_t));
+        cache_pwrite(sb, fd, zero, (p - slot) * sizeof(uint32_t), get_block_offset(sb, nblock) + slot * sizeof(uint32_t));
+        free(zero);
+
+        return nblock;
+    }
+
+    for (i = (keep - first) / span; i < p; ++i)
+    {
+        uint32_t child = blockmap_read_ptr(sb, fd, nblock, i);
+        if (child == 0)
+            break;
+
+        if (blockmap_trim_tree(sb, fd, child, depth - 1, first + i * span, keep) == 0)
+            blockmap_write_ptr(sb, fd, nblock, i, 0);
+    }
+
+    return nblock;
+}
+
+void blockmap_truncate(struct s_superblock* sb, int fd, struct s_inode* node, uint32_t n)
+{
+    if (n >= node->nblocks)
+        return;
+
+    uint32_t nblock, start = 0, len = 0, i;
+
+    struct s_blockmap it;
+    blockmap_init(&it, sb, fd, node, n);
+
+    while ((nblock = blockmap_next(&it)) != 0)
+    {
+        if (len && nblock == start + len)
+            ++len;
+        else
+        {
+            if (len)
+                bitmap_set_extent_available(sb, fd, start, len);
+            start = nblock;
+            len = 1;
+        }
+    }
+
+    if (len)
+        bitmap_set_extent_available(sb, fd, start, len);
+
+    blockmap_del(&it);
+
+    for (i = n; i < 12; ++i)
+        node->blocks[i] = 0;
+
+    uint64_t p = blockmap_get_fanout(sb);
+    node->iblock = blockmap_trim_tree(sb, fd, node->iblock, 1, 12, n);
+    node->diblock = blockmap_trim_tree(sb, fd, node->diblock, 2, 12 + p, n);
+    node->tiblock = blockmap_trim_tree(sb, fd, node->tiblock, 3, 12 + p + p * p, n);
+    node->nblocks = n;
+}
@@ -0,0 +1,88 @@
+#ifndef BLOCKMAP_H_INCLUDED
+#define BLOCKMAP_H_INCLUDED
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "superblock.h"
+#include "inode.h"
+#include "bitmap.h"
+#include "cache.h"
+#include "utils.h"
+
+// Logical block i of an inode lives in blocks[] for i < 12, then behind
+// iblock (single), diblock (double) and tiblock (triple indirect), each
+// index block holding block_size / 4 block numbers. Index blocks are zeroed
+// when allocated, so a 0 pointer always means "not mapped yet".
+
+uint32_t blockmap_get_fanout(struct s_superblock* sb);
+
+uint64_t blockmap_get_capacity(struct s_superblock* sb);
+
+// Number of index blocks a map of n data blocks needs.
+uint32_t blockmap_get_overhead(struct s_superblock* sb, uint32_t n);
+
+// Finds the slot of logical block i: returns the top-level pointer and
+// the depth below it, and leaves the index inside that tree in *rest.
+uint32_t* blockmap_get_root(struct s_superblock* sb, struct s_inode* node, uint32_t i, uint32_t* depth, uint32_t* rest);
+
+uint32_t blockmap_get_slot(struct s_superblock* sb, uint32_t rest, uint32_t level);
+
+uint32_t blockmap_read_ptr(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t slot);
+
+void blockmap_write_ptr(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t slot, uint32_t ptr);
+
+uint32_t blockmap_get(struct s_superblock* sb, int fd, struct s_inode* node, uint32_t i);
+
+uint32_t blockmap_new_index(struct s_superblock* sb, int fd, uint32_t** spare);
+
+// Maps nblock as the next logical block of node. Index blocks the map needs
+// are taken from the zero-terminated spare list when one is given and from
+// the bitmap otherwise.
+void blockmap_append(struct s_superblock* sb, int fd, struct s_inode* node, uint32_t nblock, uint32_t** spare);
+
+// Sequential walk over the data blocks of an inode. The last index block
+// used is kept, so a full walk reads each leaf index block once.
+struct s_blockmap
+{
+    struct s_superblock* sb;
+    int fd;
+    struct s_inode* node;
+
+    uint32_t i;
+
+    uint32_t* leaf;
+    uint32_t leaf_first;
+    uint32_t leaf_block;
+};
+
+void blockmap_init(struct s_blockmap* it, struct s_superblock* sb, int fd, struct s_inode* node, uint32_t first);
+
+void blockmap_del(struct s_blockmap* it);
+
+// Returns the next data block, or 0 once the map is exhausted.
+uint32_t blockmap_next(struct s_blockmap* it);
+
+// Whole data block map of node in logical order, node->nblocks entries
+// followed by a terminating 0.
+uint32_t* blockmap_collect(struct s_superblock* sb, int fd, struct s_inode* node);
+
+// Releases the index blocks of a tree, the data blocks below it are left
+// to the caller.
+void blockmap_free_tree(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t depth);
+
+// Releases every data and index block of node and empties its map. Data
+// blocks are given back one contiguous run at a time.
+void blockmap_free(struct s_superblock* sb, int fd, struct s_inode* node);
+
+// Cuts the index tree rooted at nblock, whose first logical block is first,
+// down to the blocks below keep: index blocks left without a mapped block
+// are freed, the slots past keep in the last leaf are cleared. Returns
+// nblock, or 0 once the whole tree is gone.
+uint32_t blockmap_trim_tree(struct s_superblock* sb, int fd, uint32_t nblock, uint32_t depth, uint64_t first, uint64_t keep);
+
+// Releases every data block of node from logical block n on, with the index
+// blocks that only they needed, and shortens the map to n blocks.
+void blockmap_truncate(struct s_superblock* sb, int fd, struct s_inode* node, uint32_t n);
+
+#endif // BLOCKMAP_H_INCLUDED
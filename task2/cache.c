@@ -0,0 +1,311 @@
+#include "cache.h"
+
+void cache_init(struct s_superblock* sb, uint32_t capacity)
+{
+    struct s_cache* cache = (struct s_cache*)malloc(sizeof(struct s_cache));
+
+    cache->capacity = capacity;
+    cache->entries = (struct s_cache_entry*)calloc(capacity, sizeof(struct s_cache_entry));
+    cache->data = (uint8_t*)malloc((size_t)capacity * sb->block_size);
+
+    for (cache->nbuckets = 1; cache->nbuckets < 2 * capacity; cache->nbuckets <<= 1);
+    cache->buckets = (int32_t*)malloc(cache->nbuckets * sizeof(int32_t));
+    memset(cache->buckets, 255, cache->nbuckets * sizeof(int32_t));
+
+    cache->hand = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+
+    cache->ndirty = 0;
+    cache->dirty_max = 0;
+    cache->hold_dirty = 0;
+    cache->failed = 0;
+
+    sb->cache = cache;
+}
+
+uint8_t* cache_get_data(struct s_superblock* sb, int32_t i)
+{
+    return sb->cache->data + (size_t)i * sb->block_size;
+}
+
+int32_t* cache_get_bucket(struct s_cache* cache, uint32_t nblock)
+{
+    return cache->buckets + mod_base2(nblock * 2654435761u, cache->nbuckets);
+}
+
+int32_t cache_lookup(struct s_cache* cache, uint32_t nblock)
+{
+    int32_t i = *cache_get_bucket(cache, nblock);
+    while (i != CACHE_NONE && cache->entries[i].nblock != nblock)
+        i = cache->entries[i].next;
+
+    return i;
+}
+
+void cache_unlink(struct s_cache* cache, int32_t i)
+{
+    int32_t* link = cache_get_bucket(cache, cache->entries[i].nblock);
+    while (*link != i)
+        link = &cache->entries[*link].next;
+
+    *link = cache->entries[i].next;
+    cache->entries[i].valid = 0;
+
+    if (cache->entries[i].dirty)
+    {
+        cache->entries[i].dirty = 0;
+        --(cache->ndirty);
+    }
+}
+
+void cache_write_back(struct s_superblock* sb, int fd, int32_t i)
+{
+    struct s_cache_entry* entry = sb->cache->entries + i;
+
+    if (io_pwrite(sb, fd, cache_get_data(sb, i), sb->block_size, get_block_offset(sb, entry->nblock)) != sb->block_size)
+        sb->cache->failed = 1;
+    entry->dirty = 0;
+    --(sb->cache->ndirty);
+}
+
+void cache_grow(struct s_superblock* sb)
+{
+    struct s_cache* cache = sb->cache;
+    uint32_t i, old = cache->capacity;
+
+    cache->capacity *= 2;
+    cache->entries = (struct s_cache_entry*)realloc(cache->entries, cache->capacity * sizeof(struct s_cache_entry));
+    memset(cache->entries + old, 0, old * sizeof(struct s_cache_entry));
+    cache->data = (uint8_t*)realloc(cache->data, (size_t)cache->capacity * sb->block_size);
+
+    for (cache->nbuckets = 1; cache->nbuckets < 2 * cache->capacity; cache->nbuckets <<= 1);
+    cache->buckets = (int32_t*)realloc(cache->buckets, cache->nbuckets * sizeof(int32_t));
+    memset(cache->buckets, 255, cache->nbuckets * sizeof(int32_t));
+
+    for (i = 0; i < old; ++i)
+    {
+        if (!cache->entries[i].valid)
+            continue;
+
+        int32_t* bucket = cache_get_bucket(cache, cache->entries[i].nblock);
+        cache->entries[i].next = *bucket;
+        *bucket = i;
+    }
+
+    // the new entries are free, the hand takes them first
+    cache->hand = old;
+}
+
+int32_t cache_evict(struct s_superblock* sb, int fd)
+{
+    struct s_cache* cache = sb->cache;
+    struct s_cache_entry* entry;
+    uint32_t step;
+
+    for (step = 0; ; ++step)
+    {
+        if (cache->hold_dirty && step == 2 * cache->capacity)
+        {
+            cache_grow(sb);
+            step = 0;
+        }
+
+        int32_t i = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+
+        entry = cache->entries + i;
+        if (entry->valid && entry->ref)
+        {
+            entry->ref = 0;
+            continue;
+        }
+
+        if (entry->valid && entry->dirty && cache->hold_dirty)
+            continue;
+
+        if (entry->valid)
+        {
+            if (entry->dirty)
+                cache_write_back(sb, fd, i);
+            cache_unlink(cache, i);
+        }
+
+        return i;
+    }
+}
+
+uint8_t* cache_get_block(struct s_superblock* sb, int fd, uint32_t nblock, int fill)
+{
+    struct s_cache* cache = sb->cache;
+
+    int32_t i = cache_lookup(cache, nblock);
+    if (i != CACHE_NONE)
+    {
+        ++(cache->hits);
+        cache->entries[i].ref = 1;
+        return cache_get_data(sb, i);
+    }
+
+    ++(cache->misses);
+
+    i = cache_evict(sb, fd);
+
+    struct s_cache_entry* entry = cache->entries + i;
+    entry->nblock = nblock;
+    entry->valid = 1;
+    entry->dirty = 0;
+    entry->ref = 1;
+
+    int32_t* bucket = cache_get_bucket(cache, nblock);
+    entry->next = *bucket;
+    *bucket = i;
+
+    if (fill)
+        io_pread(sb, fd, cache_get_data(sb, i), sb->block_size, get_block_offset(sb, nblock));
+
+    return cache_get_data(sb, i);
+}
+
+void cache_pread(struct s_superblock* sb, int fd, void* buf, uint32_t len, uint64_t offset)
+{
+    if (sb->cache == NULL)
+    {
+        io_pread(sb, fd, buf, len, offset);
+        return;
+    }
+
+    uint8_t* dst = (uint8_t*)buf;
+    while (len)
+    {
+        uint32_t nblock = offset / sb->block_size;
+        uint32_t from = offset - get_block_offset(sb, nblock);
+        uint32_t n = sb->block_size - from;
+        if (n > len)
+            n = len;
+
+        memcpy(dst, cache_get_block(sb, fd, nblock, 1) + from, n);
+
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+void cache_pwrite(struct s_superblock* sb, int fd, const void* buf, uint32_t len, uint64_t offset)
+{
+    if (sb->cache == NULL)
+    {
+        io_pwrite(sb, fd, buf, len, offset);
+        return;
+    }
+
+    const uint8_t* src = (const uint8_t*)buf;
+    while (len)
+    {
+        uint32_t nblock = offset / sb->block_size;
+        uint32_t from = offset - get_block_offset(sb, nblock);
+        uint32_t n = sb->block_size - from;
+        if (n > len)
+            n = len;
+
+        memcpy(cache_get_block(sb, fd, nblock, n < sb->block_size) + from, src, n);
+
+        struct s_cache_entry* entry = sb->cache->entries + cache_lookup(sb->cache, nblock);
+        if (!entry->dirty)
+        {
+            entry->dirty = 1;
+            ++(sb->cache->ndirty);
+        }
+
+        src += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+void cache_invalidate(struct s_superblock* sb, uint32_t nblock)
+{
+    if (sb->cache == NULL)
+        return;
+
+    int32_t i = cache_lookup(sb->cache, nblock);
+    if (i != CACHE_NONE)
+        cache_unlink(sb->cache, i);
+}
+
+int cache_cmp_entries(const void* a, const void* b)
+{
+    const struct s_cache_entry* x = *(const struct s_cache_entry* const*)a;
+    const struct s_cache_entry* y = *(const struct s_cache_entry* const*)b;
+
+    return (x->nblock > y->nblock) - (x->nblock < y->nblock);
+}
+
+struct s_cache_entry** cache_get_dirty(struct s_superblock* sb, uint32_t* n)
+{
+    struct s_cache* cache = sb->cache;
+    struct s_cache_entry** dirty = (struct s_cache_entry**)malloc(cache->capacity * sizeof(struct s_cache_entry*));
+
+    uint32_t i;
+    for (*n = 0, i = 0; i < cache->capacity; ++i)
+        if (cache->entries[i].valid && cache->entries[i].dirty)
+            dirty[(*n)++] = cache->entries + i;
+
+    qsort(dirty, *n, sizeof(struct s_cache_entry*), cache_cmp_entries);
+    return dirty;
+}
+
+int cache_flush(struct s_superblock* sb, int fd)
+{
+    if (sb->cache == NULL)
+        return 1;
+
+    struct s_cache* cache = sb->cache;
+    uint32_t i, n;
+    struct s_cache_entry** dirty = cache_get_dirty(sb, &n);
+    int ok = 1;
+
+    // queued, so with io_uring the whole sweep is a single submission
+    for (i = 0; i < n; ++i)
+    {
+        ok = io_queue_pwrite(sb, fd, cache_get_data(sb, dirty[i] - cache->entries), sb->block_size, get_block_offset(sb, dirty[i]->nblock)) && ok;
+        dirty[i]->dirty = 0;
+    }
+    ok = io_wait(sb) && ok;
+    cache->ndirty -= n;
+
+    if (!ok)
+        cache->failed = 1;
+
+    free(dirty);
+    return !cache->failed;
+}
+
+void cache_drop_dirty(struct s_superblock* sb)
+{
+    if (sb->cache == NULL)
+        return;
+
+    uint32_t i;
+    for (i = 0; i < sb->cache->capacity; ++i)
+        sb->cache->entries[i].dirty = 0;
+
+    sb->cache->ndirty = 0;
+}
+
+int cache_del(struct s_superblock* sb, int fd)
+{
+    if (sb->cache == NULL)
+        return 1;
+
+    int ok = cache_flush(sb, fd);
+
+    free(sb->cache->entries);
+    free(sb->cache->data);
+    free(sb->cache->buckets);
+    free(sb->cache);
+
+    sb->cache = NULL;
+    return ok;
+}
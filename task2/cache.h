@@ -0,0 +1,99 @@
+#ifndef CACHE_H_INCLUDED
+#define CACHE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "superblock.h"
+#include "utils.h"
+#include "io.h"
+
+#define CACHE_SIZE 4194304
+#define CACHE_NONE -1
+
+struct s_cache_entry
+{
+    uint32_t nblock;
+    int32_t next;
+
+    uint8_t valid;
+    uint8_t dirty;
+    uint8_t ref;
+};
+
+struct s_cache
+{
+    struct s_cache_entry* entries;
+    uint8_t* data;
+    uint32_t capacity;
+
+    int32_t* buckets;
+    uint32_t nbuckets;
+
+    uint32_t hand;
+
+    uint64_t hits;
+    uint64_t misses;
+
+    // set by journal_open: dirty blocks stay in the cache until a commit
+    // between two operations writes them back, and the cache grows rather
+    // than evicting one; a commit is due once dirty_max of them pile up
+    uint32_t ndirty;
+    uint32_t dirty_max;
+    uint8_t hold_dirty;
+
+    // a dirty block could not be written back and is lost to the image;
+    // every flush from then on fails
+    uint8_t failed;
+};
+
+void cache_init(struct s_superblock* sb, uint32_t capacity);
+
+uint8_t* cache_get_data(struct s_superblock* sb, int32_t i);
+
+int32_t* cache_get_bucket(struct s_cache* cache, uint32_t nblock);
+
+int32_t cache_lookup(struct s_cache* cache, uint32_t nblock);
+
+void cache_unlink(struct s_cache* cache, int32_t i);
+
+// Writes entry i back and marks it clean, whether the write made it or not;
+// a failed one sets failed.
+void cache_write_back(struct s_superblock* sb, int fd, int32_t i);
+
+// Doubles the capacity, keeping every entry where it is.
+void cache_grow(struct s_superblock* sb);
+
+// CLOCK: give every referenced entry a second chance, evict the first one
+// that was not touched since the hand last passed it. Under a journal dirty
+// entries are never evicted; with no clean one left the cache grows.
+int32_t cache_evict(struct s_superblock* sb, int fd);
+
+// Returns the cached copy of nblock, reading it from the image on a miss
+// unless the caller is about to overwrite the whole block.
+uint8_t* cache_get_block(struct s_superblock* sb, int fd, uint32_t nblock, int fill);
+
+void cache_pread(struct s_superblock* sb, int fd, void* buf, uint32_t len, uint64_t offset);
+
+void cache_pwrite(struct s_superblock* sb, int fd, const void* buf, uint32_t len, uint64_t offset);
+
+// Drops nblock without writing it back, for blocks that were freed or are
+// about to be overwritten directly on the image.
+void cache_invalidate(struct s_superblock* sb, uint32_t nblock);
+
+int cache_cmp_entries(const void* a, const void* b);
+
+// Dirty entries in block order, so writing them is one forward sweep.
+struct s_cache_entry** cache_get_dirty(struct s_superblock* sb, uint32_t* n);
+
+// Writes every dirty block back; returns 0 if a write failed, now or in an
+// earlier write-back.
+int cache_flush(struct s_superblock* sb, int fd);
+
+// Forgets that blocks are dirty, for when they must not reach the image.
+void cache_drop_dirty(struct s_superblock* sb);
+
+int cache_del(struct s_superblock* sb, int fd);
+
+#endif // CACHE_H_INCLUDED
@@ -0,0 +1,134 @@
+#include "dcache.h"
+
+void dcache_init(struct s_superblock* sb, uint32_t capacity)
+{
+    struct s_dcache* dc = (struct s_dcache*)malloc(sizeof(struct s_dcache));
+
+    dc->capacity = capacity;
+    dc->entries = (struct s_dcache_entry*)calloc(capacity, sizeof(struct s_dcache_entry));
+
+    for (dc->nbuckets = 1; dc->nbuckets < 2 * capacity; dc->nbuckets <<= 1);
+    dc->buckets = (int32_t*)malloc(dc->nbuckets * sizeof(int32_t));
+    memset(dc->buckets, 255, dc->nbuckets * sizeof(int32_t));
+
+    dc->hand = 0;
+    dc->hits = 0;
+    dc->misses = 0;
+
+    sb->dcache = dc;
+}
+
+void dcache_del(struct s_superblock* sb)
+{
+    if (sb->dcache == NULL)
+        return;
+
+    free(sb->dcache->entries);
+    free(sb->dcache->buckets);
+    free(sb->dcache);
+
+    sb->dcache = NULL;
+}
+
+uint32_t dcache_hash(uint32_t parent, const char* name)
+{
+    uint32_t i, h = parent * 2654435761u;
+    for (i = 0; i < NAME_LEN - 1 && name[i]; ++i)
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+
+    return h;
+}
+
+int32_t* dcache_get_bucket(struct s_dcache* dc, uint32_t parent, const char* name)
+{
+    return dc->buckets + mod_base2(dcache_hash(parent, name), dc->nbuckets);
+}
+
+int32_t dcache_lookup(struct s_dcache* dc, uint32_t parent, const char* name)
+{
+    int32_t i = *dcache_get_bucket(dc, parent, name);
+    while (i != DCACHE_NONE && (dc->entries[i].parent != parent || strncmp(dc->entries[i].name, name, NAME_LEN - 1) != 0))
+        i = dc->entries[i].next;
+
+    return i;
+}
+
+void dcache_unlink(struct s_dcache* dc, int32_t i)
+{
+    int32_t* link = dcache_get_bucket(dc, dc->entries[i].parent, dc->entries[i].name);
+    while (*link != i)
+        link = &dc->entries[*link].next;
+
+    *link = dc->entries[i].next;
+    dc->entries[i].valid = 0;
+}
+
+int32_t dcache_evict(struct s_dcache* dc)
+{
+    for (;;)
+    {
+        int32_t i = dc->hand;
+        dc->hand = (dc->hand + 1) % dc->capacity;
+
+        struct s_dcache_entry* entry = dc->entries + i;
+        if (entry->valid && entry->ref)
+        {
+            entry->ref = 0;
+            continue;
+        }
+
+        if (entry->valid)
+            dcache_unlink(dc, i);
+
+        return i;
+    }
+}
+
+int dcache_get(struct s_superblock* sb, uint32_t parent, const char* name, uint32_t* ninode, char* type)
+{
+    struct s_dcache* dc = sb->dcache;
+    if (dc == NULL)
+        return 0;
+
+    int32_t i = dcache_lookup(dc, parent, name);
+    if (i == DCACHE_NONE)
+    {
+        ++(dc->misses);
+        return 0;
+    }
+
+    ++(dc->hits);
+    dc->entries[i].ref = 1;
+
+    *ninode = dc->entries[i].ninode;
+    *type = dc->entries[i].type;
+
+    return 1;
+}
+
+void dcache_set(struct s_superblock* sb, uint32_t parent, const char* name, uint32_t ninode, char type)
+{
+    struct s_dcache* dc = sb->dcache;
+    if (dc == NULL)
+        return;
+
+    int32_t i = dcache_lookup(dc, parent, name);
+    if (i == DCACHE_NONE)
+    {
+        i = dcache_evict(dc);
+
+        struct s_dcache_entry* entry = dc->entries + i;
+        entry->parent = parent;
+        strncpy(entry->name, name, NAME_LEN - 1);
+        entry->name[NAME_LEN - 1] = 0;
+        entry->valid = 1;
+
+        int32_t* bucket = dcache_get_bucket(dc, parent, name);
+        entry->next = *bucket;
+        *bucket = i;
+    }
+
+    dc->entries[i].ninode = ninode;
+    dc->entries[i].type = type;
+    dc->entries[i].ref = 1;
+}
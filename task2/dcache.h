@@ -0,0 +1,69 @@
+#ifndef DCACHE_H_INCLUDED
+#define DCACHE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "superblock.h"
+#include "inode.h"
+#include "utils.h"
+
+#define DCACHE_SIZE 16384
+#define DCACHE_NONE -1
+
+// Dentry cache: what looking name up in directory parent gave, keyed by
+// (parent, name), so walking a path neither searches the directories on the
+// way nor reads their inodes. ninode 0 is a negative entry, the name is known
+// not to be there. Every create and remove sets the entry of its name, so
+// entries never go stale and there is nothing to invalidate. A removed
+// directory was empty, so whatever is left under its inode number is
+// negative and stays true for an empty directory that reuses it.
+struct s_dcache_entry
+{
+    uint32_t parent;
+    uint32_t ninode;
+    char type;
+    char name[NAME_LEN];
+
+    int32_t next;
+
+    uint8_t valid;
+    uint8_t ref;
+};
+
+struct s_dcache
+{
+    struct s_dcache_entry* entries;
+    uint32_t capacity;
+
+    int32_t* buckets;
+    uint32_t nbuckets;
+
+    uint32_t hand;
+
+    uint64_t hits;
+    uint64_t misses;
+};
+
+void dcache_init(struct s_superblock* sb, uint32_t capacity);
+
+void dcache_del(struct s_superblock* sb);
+
+uint32_t dcache_hash(uint32_t parent, const char* name);
+
+int32_t* dcache_get_bucket(struct s_dcache* dc, uint32_t parent, const char* name);
+
+int32_t dcache_lookup(struct s_dcache* dc, uint32_t parent, const char* name);
+
+void dcache_unlink(struct s_dcache* dc, int32_t i);
+
+// CLOCK, like the block cache: referenced entries get a second chance.
+int32_t dcache_evict(struct s_dcache* dc);
+
+// Returns 1 if the outcome of looking name up in parent is known, with the
+// inode and type it names in *ninode and *type, *ninode 0 if none.
+int dcache_get(struct s_superblock* sb, uint32_t parent, const char* name, uint32_t* ninode, char* type);
+
+void dcache_set(struct s_superblock* sb, uint32_t parent, const char* name, uint32_t ninode, char type);
+
+#endif // DCACHE_H_INCLUDED
@@ -0,0 +1,138 @@
+#include "dirsize.h"
+
+void dirsize_init(struct s_superblock* sb)
+{
+    struct s_dirsize* ds = (struct s_dirsize*)malloc(sizeof(struct s_dirsize));
+
+    ds->count = 0;
+    ds->capacity = 64;
+    ds->entries = (struct s_dirsize_entry*)malloc(ds->capacity * sizeof(struct s_dirsize_entry));
+
+    ds->nbuckets = 2 * ds->capacity;
+    ds->buckets = (int32_t*)malloc(ds->nbuckets * sizeof(int32_t));
+    memset(ds->buckets, 255, ds->nbuckets * sizeof(int32_t));
+
+    sb->dirsize = ds;
+}
+
+void dirsize_del(struct s_superblock* sb)
+{
+    if (sb->dirsize == NULL)
+        return;
+
+    free(sb->dirsize->entries);
+    free(sb->dirsize->buckets);
+    free(sb->dirsize);
+
+    sb->dirsize = NULL;
+}
+
+void dirsize_clear(struct s_superblock* sb)
+{
+    struct s_dirsize* ds = sb->dirsize;
+
+    ds->count = 0;
+    memset(ds->buckets, 255, ds->nbuckets * sizeof(int32_t));
+}
+
+int32_t* dirsize_get_bucket(struct s_dirsize* ds, uint32_t ninode)
+{
+    return ds->buckets + mod_base2(ninode * 2654435761u, ds->nbuckets);
+}
+
+int32_t dirsize_lookup(struct s_dirsize* ds, uint32_t ninode)
+{
+    int32_t i = *dirsize_get_bucket(ds, ninode);
+    while (i != DIRSIZE_NONE && ds->entries[i].ninode != ninode)
+        i = ds->entries[i].next;
+
+    return i;
+}
+
+void dirsize_grow(struct s_dirsize* ds)
+{
+    uint32_t i;
+
+    ds->capacity *= 2;
+    ds->entries = (struct s_dirsize_entry*)realloc(ds->entries, ds->capacity * sizeof(struct s_dirsize_entry));
+
+    ds->nbuckets = 2 * ds->capacity;
+    ds->buckets = (int32_t*)realloc(ds->buckets, ds->nbuckets * sizeof(int32_t));
+    memset(ds->buckets, 255, ds->nbuckets * sizeof(int32_t));
+
+    for (i = 0; i < ds->count; ++i)
+    {
+        if (ds->entries[i].ninode == 0)
+            continue;
+
+        int32_t* bucket = dirsize_get_bucket(ds, ds->entries[i].ninode);
+        ds->entries[i].next = *bucket;
+        *bucket = i;
+    }
+}
+
+int64_t dirsize_get(struct s_superblock* sb, uint32_t ninode)
+{
+    if (sb->dirsize == NULL)
+        return 0;
+
+    int32_t i = dirsize_lookup(sb->dirsize, ninode);
+    return i == DIRSIZE_NONE ? 0 : sb->dirsize->entries[i].delta;
+}
+
+void dirsize_add(struct s_superblock* sb, int fd, uint32_t ninode, int64_t delta)
+{
+    if (sb->dirsize == NULL)
+        dirsize_init(sb);
+
+    struct s_dirsize* ds = sb->dirsize;
+    struct s_inode* node = NULL;
+
+    while (ninode)
+    {
+        int32_t i = dirsize_lookup(ds, ninode);
+        if (i == DIRSIZE_NONE)
+        {
+            if (ds->count == ds->capacity)
+                dirsize_grow(ds);
+
+            if (node == NULL)
+                inode_init(&node, 0, 0, "", 0);
+            inode_read(node, sb, fd, ninode);
+
+            i = ds->count++;
+            ds->entries[i].ninode = ninode;
+            ds->entries[i].parent = node->parent_inode;
+            ds->entries[i].delta = 0;
+
+            int32_t* bucket = dirsize_get_bucket(ds, ninode);
+            ds->entries[i].next = *bucket;
+            *bucket = i;
+        }
+
+        ds->entries[i].delta += delta;
+        ninode = ds->entries[i].parent;
+    }
+
+    if (node)
+        inode_del(node);
+}
+
+void dirsize_drop(struct s_superblock* sb, uint32_t ninode)
+{
+    if (sb->dirsize == NULL)
+        return;
+
+    struct s_dirsize* ds = sb->dirsize;
+    int32_t i = dirsize_lookup(ds, ninode);
+    if (i == DIRSIZE_NONE)
+        return;
+
+    int32_t* link = dirsize_get_bucket(ds, ninode);
+    while (*link != i)
+        link = &ds->entries[*link].next;
+
+    *link = ds->entries[i].next;
+    ds->entries[i].ninode = 0;
+    ds->entries[i].delta = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef DIRSIZE_H_INCLUDED
+#define DIRSIZE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "superblock.h"
+#include "inode.h"
+#include "utils.h"
+
+#define DIRSIZE_NONE -1
+
+// Directory sizes are not rewritten up to the root on every change. A change
+// is added as a delta to the directory and to each of its ancestors in this
+// table, keyed by inode number, and fs_sync applies all of them with one
+// write of every touched inode and of its entry in the parent, as part of
+// every commit. Until then on-disk sizes lag behind, so readers add
+// dirsize_get to them.
+struct s_dirsize_entry
+{
+    uint32_t ninode;
+    uint32_t parent;
+    int64_t delta;
+
+    int32_t next;
+};
+
+struct s_dirsize
+{
+    struct s_dirsize_entry* entries;
+    uint32_t count;
+    uint32_t capacity;
+
+    int32_t* buckets;
+    uint32_t nbuckets;
+};
+
+void dirsize_init(struct s_superblock* sb);
+
+void dirsize_del(struct s_superblock* sb);
+
+void dirsize_clear(struct s_superblock* sb);
+
+int32_t* dirsize_get_bucket(struct s_dirsize* ds, uint32_t ninode);
+
+int32_t dirsize_lookup(struct s_dirsize* ds, uint32_t ninode);
+
+void dirsize_grow(struct s_dirsize* ds);
+
+// Pending change of the size of directory ninode.
+int64_t dirsize_get(struct s_superblock* sb, uint32_t ninode);
+
+// Adds delta to the size of directory ninode and of all its ancestors. The
+// parent of a directory is read once, when it first enters the table; from
+// there on the walk to the root stays in memory.
+void dirsize_add(struct s_superblock* sb, int fd, uint32_t ninode, int64_t delta);
+
+// Forgets directory ninode once it is removed, so that its pending delta is
+// not applied to whatever reuses the inode.
+void dirsize_drop(struct s_superblock* sb, uint32_t ninode);
+
+#endif // DIRSIZE_H_INCLUDED
@@ -0,0 +1,908 @@
+#include "fs.h"
+
+uint32_t* fs_reserve_blocks(struct s_superblock* sb, int fd, uint32_t n)
+{
+    uint32_t* blocks = (uint32_t*)malloc((n + 1) * sizeof(uint32_t));
+    uint32_t k, len, start, got;
+
+    for (got = 0; got < n; got += len)
+    {
+        len = bitmap_get_available_extent(sb, fd, n - got, &start);
+        if (len == 0)
+            break;
+
+        bitmap_set_extent_unavailable(sb, fd, start, len);
+        for (k = 0; k < len; ++k)
+            blocks[got + k] = start + k;
+    }
+
+    blocks[n] = 0;
+    return blocks;
+}
+
+void fs_set_blocks(struct s_superblock* sb, int fd, struct s_inode* node, uint32_t* blocks, uint32_t n, uint32_t* spare)
+{
+    uint32_t i;
+    for (i = 0; i < n; ++i)
+        blockmap_append(sb, fd, node, blocks[i], &spare);
+}
+
+uint32_t fs_dirent_decode(struct s_dirent* de, const uint8_t* buf)
+{
+    de->ninode = inode_get32(buf);
+    de->size = inode_get32(buf + 4);
+    de->type = buf[8];
+    de->name_len = buf[9];
+
+    de->mtime = inode_get64(buf + 10);
+
+    memcpy(de->name, buf + DIRENT_HEAD, de->name_len);
+    de->name[de->name_len] = 0;
+
+    return DIRENT_HEAD + de->name_len;
+}
+
+uint32_t fs_dirent_encode(struct s_dirent* de, uint8_t* buf)
+{
+    inode_put32(buf, de->ninode);
+    inode_put32(buf + 4, de->size);
+    buf[8] = de->type;
+    buf[9] = de->name_len;
+    inode_put64(buf + 10, de->mtime);
+    memcpy(buf + DIRENT_HEAD, de->name, de->name_len);
+
+    return DIRENT_HEAD + de->name_len;
+}
+
+void fs_dirent_init(struct s_dirent* de, struct s_inode* node)
+{
+    de->ninode = node->ninode;
+    de->size = node->size;
+    de->type = node->type;
+    de->name_len = strnlen(node->name, NAME_LEN - 1);
+
+    de->mtime = node->mtime;
+
+    memcpy(de->name, node->name, de->name_len);
+    de->name[de->name_len] = 0;
+}
+
+uint32_t fs_dir_hash(const char* name)
+{
+    uint32_t i, h = DIR_HASH_OFFSET;
+    for (i = 0; i < NAME_LEN - 1 && name[i]; ++i)
+        h = (h ^ (uint8_t)name[i]) * DIR_HASH_PRIME;
+
+    return h;
+}
+
+uint32_t fs_dir_get_nbuckets(struct s_superblock* sb)
+{
+    return sb->block_size / sizeof(uint32_t) - 1;
+}
+
+uint32_t fs_dir_get_head(struct s_superblock* sb, const uint8_t* index, const char* name)
+{
+    return inode_get32(index + (1 + fs_dir_hash(name) % fs_dir_get_nbuckets(sb)) * sizeof(uint32_t));
+}
+
+uint32_t fs_dir_count(struct s_superblock* sb, int fd, struct s_inode* node)
+{
+    uint8_t count[sizeof(uint32_t)] = {0};
+    if (node->nblocks)
+        cache_pread(sb, fd, count, sizeof(uint32_t), get_block_offset(sb, node->blocks[0]));
+
+    return inode_get32(count);
+}
+
+uint32_t fs_dir_lookup(struct s_superblock* sb, int fd, uint32_t nblock, const char* name, uint8_t* block, uint32_t* nbucket, struct s_dirent* de)
+{
+    uint32_t len = strnlen(name, NAME_LEN - 1);
+    uint32_t off, used;
+
+    for (; nblock; nblock = inode_get32(block))
+    {
+        cache_pread(sb, fd, block, sb->block_size, get_block_offset(sb, nblock));
+        used = inode_get32(block + 4);
+
+        for (off = DIR_BUCKET_HEAD; off < DIR_BUCKET_HEAD + used; )
+        {
+            uint32_t rec = fs_dirent_decode(de, block + off);
+            if (de->name_len == len && memcmp(de->name, name, len) == 0)
+            {
+                *nbucket = nblock;
+                return off;
+            }
+
+            off += rec;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t fs_dir_find(struct s_superblock* sb, int fd, struct s_inode* node, const char* name, char* type)
+{
+    uint32_t ninode = 0;
+    *type = 0;
+
+    if (node->nblocks == 0)
+        return 0;
+
+    uint8_t* block = (uint8_t*)malloc(sb->block_size);
+    uint32_t nbucket;
+    struct s_dirent de;
+
+    cache_pread(sb, fd, block, sb->block_size, get_block_offset(sb, node->blocks[0]));
+    if (fs_dir_lookup(sb, fd, fs_dir_get_head(sb, block, name), name, block, &nbucket, &de))
+    {
+        ninode = de.ninode;
+        *type = de.type;
+    }
+
+    free(block);
+
+    return ninode;
+}
+
+uint32_t fs_lookup(struct s_superblock* sb, int fd, struct s_inode* node, const char* name, char* type)
+{
+    uint32_t ninode;
+    if (dcache_get(sb, node->ninode, name, &ninode, type))
+        return ninode;
+
+    ninode = fs_dir_find(sb, fd, node, name, type);
+    dcache_set(sb, node->ninode, name, ninode, *type);
+
+    return ninode;
+}
+
+uint32_t fs_find_ninode(struct s_superblock* sb, int fd, struct s_inode* node, const char* name)
+{
+    char type;
+    return fs_lookup(sb, fd, node, name, &type);
+}
+
+int fs_dir_insert(struct s_superblock* sb, int fd, struct s_inode* node, struct s_inode* child)
+{
+    struct s_dirent de;
+    fs_dirent_init(&de, child);
+
+    uint32_t nblocks = node->nblocks;
+    uint8_t* index = (uint8_t*)malloc(sb->block_size);
+    uint8_t* bucket = (uint8_t*)malloc(sb->block_size);
+    uint32_t b = (1 + fs_dir_hash(de.name) % fs_dir_get_nbuckets(sb)) * sizeof(uint32_t), nblock = 0;
+    uint32_t rec = DIRENT_HEAD + de.name_len, used = 0;
+
+    if (nblocks)
+    {
+        cache_pread(sb, fd, index, sb->block_size, get_block_offset(sb, node->blocks[0]));
+
+        for (nblock = inode_get32(index + b); nblock; nblock = inode_get32(bucket))
+        {
+            cache_pread(sb, fd, bucket, sb->block_size, get_block_offset(sb, nblock));
+            used = inode_get32(bucket + 4);
+            if (DIR_BUCKET_HEAD + used + rec <= sb->block_size)
+                break;
+        }
+    }
+
+    if (nblock == 0)
+    {
+        uint32_t add = (nblocks == 0) + 1;
+        int status = 0;
+
+        if (nblocks + add > blockmap_get_capacity(sb))
+            status = -EMLINK;
+        else if (sb->blocks_remain < add + blockmap_get_overhead(sb, nblocks + add) - blockmap_get_overhead(sb, nblocks))
+            status = -ENOSPC;
+
+        if (status != 0)
+        {
+            free(index);
+            free(bucket);
+            return status;
+        }
+
+        if (nblocks == 0)
+        {
+            memset(index, 0, sb->block_size);
+
+            uint32_t nindex = bitmap_get_available_block(sb, fd);
+            bitmap_set_unavailable(sb, fd, nindex);
+            blockmap_append(sb, fd, node, nindex, NULL);
+        }
+
+        nblock = bitmap_get_available_block(sb, fd);
+        bitmap_set_unavailable(sb, fd, nblock);
+        blockmap_append(sb, fd, node, nblock, NULL);
+
+        memset(bucket, 0, sb->block_size);
+        inode_put32(bucket, inode_get32(index + b));
+        inode_put32(index + b, nblock);
+        used = 0;
+    }
+
+    used += fs_dirent_encode(&de, bucket + DIR_BUCKET_HEAD + used);
+    inode_put32(bucket + 4, used);
+    inode_put32(index, inode_get32(index) + 1);
+
+    cache_pwrite(sb, fd, bucket, sb->block_size, get_block_offset(sb, nblock));
+    cache_pwrite(sb, fd, index, sb->block_size, get_block_offset(sb, node->blocks[0]));
+
+    free(index);
+    free(bucket);
+
+    return 0;
+}
+
+void fs_dir_remove(struct s_superblock* sb, int fd, struct s_inode* node, const char* name)
+{
+    uint8_t* block = (uint8_t*)malloc(sb->block_size);
+    uint8_t count[sizeof(uint32_t)];
+    uint32_t nbucket, off;
+    struct s_dirent de;
+
+    cache_pread(sb, fd, block, sb->block_size, get_block_offset(sb, node->blocks[0]));
+    inode_put32(count, inode_get32(block) - 1);
+
+    off = fs_dir_lookup(sb, fd, fs_dir_get_head(sb, block, name), name, block, &nbucket, &de);
+    if (off)
+    {
+        uint32_t rec = DIRENT_HEAD + de.name_len;
+        uint32_t end = DIR_BUCKET_HEAD + inode_get32(block + 4);
+
+        memmove(block + off, block + off + rec, end - off - rec);
+        inode_put32(block + 4, end - DIR_BUCKET_HEAD - rec);
+
+        cache_pwrite(sb, fd, block, sb->block_size, get_block_offset(sb, nbucket));
+        cache_pwrite(sb, fd, count, sizeof(uint32_t), get_block_offset(sb, node->blocks[0]));
+    }
+
+    free(block);
+}
+
+void fs_dir_set_size(struct s_superblock* sb, int fd, struct s_inode* node, struct s_inode* child)
+{
+    uint8_t* block = (uint8_t*)malloc(sb->block_size);
+    uint32_t nbucket, off;
+    struct s_dirent de;
+
+    cache_pread(sb, fd, block, sb->block_size, get_block_offset(sb, node->blocks[0]));
+
+    off = fs_dir_lookup(sb, fd, fs_dir_get_head(sb, block, child->name), child->name, block, &nbucket, &de);
+    if (off)
+    {
+        inode_put32(block + off + 4, child->size);
+        inode_put64(block + off + 10, child->mtime);
+        cache_pwrite(sb, fd, block + off + 4, sizeof(uint32_t), get_block_offset(sb, nbucket) + off + 4);
+        cache_pwrite(sb, fd, block + off + 10, sizeof(uint64_t), get_block_offset(sb, nbucket) + off + 10);
+    }
+
+    free(block);
+}
+
+void fs_update_ancestors_size(struct s_superblock* sb, int fd, struct s_inode* node, int32_t size)
+{
+    dirsize_add(sb, fd, node->parent_inode, size);
+}
+
+void fs_flush_sizes(struct s_superblock* sb, int fd)
+{
+    struct s_dirsize* ds = sb->dirsize;
+    if (ds == NULL || ds->count == 0)
+        return;
+
+    struct s_inode *node, *parent;
+    inode_init(&node, 0, 0, "", 0);
+    inode_init(&parent, 0, 0, "", 0);
+
+    uint32_t i;
+    for (i = 0; i < ds->count; ++i)
+    {
+        if (ds->entries[i].ninode == 0 || ds->entries[i].delta == 0)
+            continue;
+
+        inode_read(node, sb, fd, ds->entries[i].ninode);
+        node->size += ds->entries[i].delta;
+        inode_write(node, sb, fd, node->ninode);
+
+        if (node->parent_inode)
+        {
+            inode_read(parent, sb, fd, node->parent_inode);
+            fs_dir_set_size(sb, fd, parent, node);
+        }
+    }
+
+    dirsize_clear(sb);
+
+    inode_del(node);
+    inode_del(parent);
+}
+
+int fs_sync(struct s_superblock* sb, int fd)
+{
+    // the size deltas go into the same transaction as the entries they
+    // account for, so no commit leaves a directory size behind
+    fs_flush_sizes(sb, fd);
+
+    bitmap_flush(sb, fd);
+    cache_pwrite(sb, fd, sb, superblock_get_size(sb), 0);
+
+    if (sb->journal)
+        return journal_commit(sb, fd);
+
+    int ok = cache_flush(sb, fd);
+    ok = io_sync(sb, fd) && ok;
+
+    return ok ? 0 : -EIO;
+}
+
+const char* fs_strerror(int error)
+{
+    switch (-error)
+    {
+    case 0:
+        return "success";
+    case ENOSPC:
+        return "no available space";
+    case ENFILE:
+        return "no available inodes";
+    case EMLINK:
+        return "max number of subdirectories/files reached";
+    case EEXIST:
+        return "object exists";
+    case ENOENT:
+        return "no such object";
+    case ENOTDIR:
+        return "not a directory";
+    case EISDIR:
+        return "is a directory";
+    case ENOTEMPTY:
+        return "directory is not empty";
+    case EFBIG:
+        return "file too large";
+    case EINVAL:
+        return "empty or invalid name";
+    case ENAMETOOLONG:
+        return "name too long";
+    case ENOTSUP:
+        return "not a regular file or directory";
+    case EPROTO:
+        return "unsupported format revision, recreate the image with fs_init";
+    default:
+        return strerror(-error);
+    }
+}
+
+uint32_t fs_path_next(const char** path, const char** name)
+{
+    const char* p = *path;
+    while (*p == '/')
+        ++p;
+
+    *name = p;
+    while (*p && *p != '/')
+        ++p;
+
+    *path = p;
+    return p - *name;
+}
+
+int fs_resolve(struct s_superblock* sb, int fd, const char* path, struct s_inode* node)
+{
+    char name[NAME_LEN];
+    const char* comp;
+    uint32_t len, ninode = sb->root_inode, parent = 0, child;
+    char type = 'd';
+
+    // Inodes are read lazily: a component that hits the dentry cache gives
+    // the next inode number and type without reading anything, and ".."
+    // takes the parent from the step that led here while up is set. node
+    // holds inode ninode only while loaded is set.
+    int loaded = 0, up = 1;
+
+    while ((len = fs_path_next(&path, &comp)) != 0)
+    {
+        if (type != 'd')
+            return -ENOTDIR;
+        if (len >= NAME_LEN)
+            return -ENAMETOOLONG;
+
+        if (len == 1 && comp[0] == '.')
+            continue;
+
+        if (len == 2 && comp[0] == '.' && comp[1] == '.')
+        {
+            if (!up)
+            {
+                if (!loaded)
+                    inode_read(node, sb, fd, ninode);
+                loaded = 1;
+                parent = node->parent_inode;
+            }
+
+            if (parent)
+            {
+                ninode = parent;
+                loaded = up = 0;
+            }
+
+            continue;
+        }
+
+        memcpy(name, comp, len);
+        name[len] = 0;
+
+        if (!dcache_get(sb, ninode, name, &child, &type))
+        {
+            if (!loaded)
+                inode_read(node, sb, fd, ninode);
+
+            child = fs_dir_find(sb, fd, node, name, &type);
+            dcache_set(sb, ninode, name, child, type);
+        }
+
+        if (child == 0)
+            return -ENOENT;
+
+        parent = ninode;
+        ninode = child;
+        loaded = 0;
+        up = 1;
+    }
+
+    if (!loaded)
+        inode_read(node, sb, fd, ninode);
+
+    return 0;
+}
+
+int fs_resolve_parent(struct s_superblock* sb, int fd, const char* path, struct s_inode* dir, char* name)
+{
+    const char *comp = NULL, *next = path, *last = NULL;
+    uint32_t len, last_len = 0;
+
+    while ((len = fs_path_next(&next, &comp)) != 0)
+    {
+        last = comp;
+        last_len = len;
+    }
+
+    if (last == NULL || (last_len == 1 && last[0] == '.') || (last_len == 2 && last[0] == '.' && last[1] == '.'))
+        return -EINVAL;
+    if (last_len >= NAME_LEN)
+        return -ENAMETOOLONG;
+
+    memcpy(name, last, last_len);
+    name[last_len] = 0;
+
+    char* prefix = (char*)malloc(last - path + 1);
+    memcpy(prefix, path, last - path);
+    prefix[last - path] = 0;
+
+    int status = fs_resolve(sb, fd, prefix, dir);
+    if (status == 0 && dir->type != 'd')
+        status = -ENOTDIR;
+
+    free(prefix);
+    return status;
+}
+
+int fs_make_node(struct s_superblock* sb, int fd, struct s_inode* node, const char* name, char type, uint32_t* ninode)
+{
+    // an empty file needs no block, a directory is refused on a full image
+    // as it could not take a single entry; room in node is fs_dir_insert's
+    if (type == 'd' && sb->blocks_remain == 0)
+        return -ENOSPC;
+
+    if (sb->inodes_remain == 0)
+        return -ENFILE;
+
+    if (fs_find_ninode(sb, fd, node, name))
+        return -EEXIST;
+
+    *ninode = bitmap_get_available_inode(sb, fd);
+    bitmap_set_inode_unavailable(sb, fd, *ninode);
+
+    struct s_inode* child;
+    inode_init(&child, *ninode, node->ninode, name, type);
+
+    int status = fs_dir_insert(sb, fd, node, child);
+    if (status != 0)
+    {
+        bitmap_set_inode_available(sb, fd, *ninode);
+        inode_del(child);
+        return status;
+    }
+
+    dcache_set(sb, node->ninode, name, *ninode, type);
+
+    node->mtime = node->ctime = child->ctime;
+
+    inode_write(child, sb, fd, *ninode);
+    inode_write(node, sb, fd, node->ninode);
+
+    fs_update_ancestors_size(sb, fd, child, child->size);
+
+    inode_del(child);
+    return 0;
+}
+
+int fs_make_dir(struct s_superblock* sb, int fd, struct s_inode* node, const char* name, uint32_t* ninode)
+{
+    return fs_make_node(sb, fd, node, name, 'd', ninode);
+}
+
+int fs_readdir(struct s_superblock* sb, int fd, struct s_inode* node, fs_dir_fn fn, void* arg)
+{
+    if (node->nblocks == 0)
+        return 0;
+
+    uint8_t* block = (uint8_t*)malloc(sb->block_size);
+    uint32_t nblock, off, end;
+    struct s_dirent de;
+    int status = 0;
+
+    struct s_blockmap it;
+    blockmap_init(&it, sb, fd, node, 1);
+
+    while (status == 0 && (nblock = blockmap_next(&it)) != 0)
+    {
+        cache_pread(sb, fd, block, sb->block_size, get_block_offset(sb, nblock));
+
+        end = DIR_BUCKET_HEAD + inode_get32(block + 4);
+        for (off = DIR_BUCKET_HEAD; status == 0 && off < end; )
+        {
+            off += fs_dirent_decode(&de, block + off);
+            de.size += dirsize_get(sb, de.ninode);
+
+            status = fn(arg, &de);
+        }
+    }
+
+    blockmap_del(&it);
+    free(block);
+
+    return status;
+}
+
+void fs_erase_file(struct s_superblock* sb, int fd, struct s_inode* node)
+{
+    blockmap_free(sb, fd, node);
+}
+
+int fs_remove(struct s_superblock* sb, int fd, struct s_inode* node, const char* name)
+{
+    uint32_t ninode = fs_find_ninode(sb, fd, node, name);
+    if (ninode == 0)
+        return -ENOENT;
+
+    struct s_inode* tmp;
+    inode_init(&tmp, 0, 0, "", '\0');
+    inode_read(tmp, sb, fd, ninode);
+
+    if (tmp->type == 'd' && fs_dir_count(sb, fd, tmp) != 0)
+    {
+        inode_del(tmp);
+        return -ENOTEMPTY;
+    }
+
+    fs_erase_file(sb, fd, tmp);
+    bitmap_set_inode_available(sb, fd, ninode);
+
+    fs_dir_remove(sb, fd, node, name);
+    dcache_set(sb, node->ninode, name, 0, 0);
+
+    node->mtime = node->ctime = get_time_ns();
+    inode_write(node, sb, fd, node->ninode);
+
+    fs_update_ancestors_size(sb, fd, tmp, -(tmp->size + dirsize_get(sb, tmp->ninode)));
+    dirsize_drop(sb, tmp->ninode);
+
+    inode_del(tmp);
+    return 0;
+}
+
+int fs_move(struct s_superblock* sb, int fd, struct s_inode* node, uint8_t* buf, uint64_t len, uint64_t off, int write)
+{
+    struct s_blockmap it;
+    blockmap_init(&it, sb, fd, node, off / sb->block_size);
+
+    uint64_t done = 0, run = 0, start = 0;
+    uint32_t skip = off % sb->block_size, nblock, last = 0;
+    int ok = 1;
+
+    // zeros are written from one buffer over and over
+    uint8_t* zero = buf ? NULL : (uint8_t*)calloc(IO_BATCH, 1);
+
+    while (ok && done + run < len && (nblock = blockmap_next(&it)) != 0)
+    {
+        uint64_t take = sb->block_size - skip;
+        if (take > len - done - run)
+            take = len - done - run;
+
+        if (run && nblock == last + 1 && run + take <= IO_BATCH)
+            run += take;
+        else
+        {
+            if (run)
+                ok = write ? io_queue_pwrite(sb, fd, zero ? zero : buf + done, run, start) : io_queue_pread(sb, fd, buf + done, run, start);
+            done += run;
+
+            start = get_block_offset(sb, nblock) + skip;
+            run = take;
+        }
+
+        last = nblock;
+        skip = 0;
+    }
+
+    if (ok && run)
+        ok = write ? io_queue_pwrite(sb, fd, zero ? zero : buf + done, run, start) : io_queue_pread(sb, fd, buf + done, run, start);
+    done += run;
+
+    blockmap_del(&it);
+
+    ok = io_wait(sb) && ok && done == len;
+    free(zero);
+
+    return ok;
+}
+
+int64_t fs_pread(struct s_superblock* sb, int fd, struct s_inode* node, uint8_t* buf, uint64_t len, uint64_t off)
+{
+    uint64_t size = node->size - INODE_SIZE;
+    if (off >= size)
+        return 0;
+    if (len > size - off)
+        len = size - off;
+
+    if (!fs_move(sb, fd, node, buf, len, off, 0))
+        return -EIO;
+
+    return len;
+}
+
+void fs_resize(struct s_superblock* sb, int fd, struct s_inode* node, uint32_t size)
+{
+    int64_t delta = (int64_t)size - node->size;
+
+    node->size = size;
+    node->mtime = node->ctime = get_time_ns();
+    inode_write(node, sb, fd, node->ninode);
+
+    struct s_inode* parent;
+    inode_init(&parent, 0, 0, "", 0);
+    inode_read(parent, sb, fd, node->parent_inode);
+    fs_dir_set_size(sb, fd, parent, node);
+    inode_del(parent);
+
+    if (delta)
+        dirsize_add(sb, fd, node->parent_inode, delta);
+}
+
+int fs_map(struct s_superblock* sb, int fd, struct s_inode* node, uint64_t size)
+{
+    uint64_t ndata = (size + sb->block_size - 1) / sb->block_size;
+    if (ndata > blockmap_get_capacity(sb) || size > UINT32_MAX - INODE_SIZE)
+        return -EFBIG;
+
+    if (ndata <= node->nblocks)
+        return 0;
+
+    uint32_t nnew = ndata - node->nblocks;
+    uint32_t n = nnew + blockmap_get_overhead(sb, ndata) - blockmap_get_overhead(sb, node->nblocks);
+    if (n > sb->blocks_remain)
+        return -ENOSPC;
+
+    uint32_t* blocks = fs_reserve_blocks(sb, fd, n);
+    fs_set_blocks(sb, fd, node, blocks, nnew, blocks + nnew);
+    free(blocks);
+
+    return 0;
+}
+
+int64_t fs_pwrite(struct s_superblock* sb, int fd, struct s_inode* node, const uint8_t* buf, uint64_t len, uint64_t off)
+{
+    if (node->type != '-')
+        return -EISDIR;
+
+    if (len == 0)
+        return 0;
+
+    uint64_t size = node->size - INODE_SIZE;
+    uint32_t nblocks = node->nblocks;
+    int ok = 1;
+
+    if (off + len > size)
+    {
+        int status = fs_map(sb, fd, node, off + len);
+        if (status != 0)
+            return status;
+
+        // a gap between the old end and off reads back as zeros
+        if (off > size)
+            ok = fs_move(sb, fd, node, NULL, off - size, size, 1);
+    }
+
+    ok = ok && fs_move(sb, fd, node, (uint8_t*)buf, len, off, 1);
+
+    // a failed write leaves the length alone and gives back what it mapped
+    if (!ok)
+    {
+        blockmap_truncate(sb, fd, node, nblocks);
+        return -EIO;
+    }
+
+    fs_resize(sb, fd, node, INODE_SIZE + (off + len > size ? off + len : size));
+
+    return len;
+}
+
+int fs_truncate(struct s_superblock* sb, int fd, struct s_inode* node, uint64_t size)
+{
+    if (node->type != '-')
+        return -EISDIR;
+
+    uint64_t old = node->size - INODE_SIZE;
+    uint32_t nblocks = node->nblocks;
+
+    if (size > old)
+    {
+        int status = fs_map(sb, fd, node, size);
+        if (status != 0)
+            return status;
+
+        if (!fs_move(sb, fd, node, NULL, size - old, old, 1))
+        {
+            blockmap_truncate(sb, fd, node, nblocks);
+            return -EIO;
+        }
+    }
+    else
+        blockmap_truncate(sb, fd, node, (size + sb->block_size - 1) / sb->block_size);
+
+    fs_resize(sb, fd, node, INODE_SIZE + size);
+
+    return 0;
+}
+
+void fs_set_times(struct s_superblock* sb, int fd, struct s_inode* node, uint64_t atime, uint64_t mtime)
+{
+    node->atime = atime;
+    node->mtime = mtime;
+    node->ctime = get_time_ns();
+    inode_write(node, sb, fd, node->ninode);
+
+    if (node->parent_inode == 0)
+        return;
+
+    struct s_inode* parent;
+    inode_init(&parent, 0, 0, "", 0);
+    inode_read(parent, sb, fd, node->parent_inode);
+    fs_dir_set_size(sb, fd, parent, node);
+    inode_del(parent);
+}
+
+int64_t fs_pull_data(struct s_superblock* sb, int fd, struct s_inode* node, const char* to, uint64_t size, int ifd, const uint8_t* buf)
+{
+    uint64_t ndata = (size + sb->block_size - 1) / sb->block_size;
+    uint64_t n = ndata + (ndata <= UINT32_MAX ? blockmap_get_overhead(sb, ndata) : 0);
+    if (ndata > blockmap_get_capacity(sb) || size > UINT32_MAX - INODE_SIZE)
+        return -EFBIG;
+
+    if (n > sb->blocks_remain)
+        return -ENOSPC;
+
+    if (sb->inodes_remain == 0)
+        return -ENFILE;
+
+    uint32_t i;
+    uint32_t* blocks = fs_reserve_blocks(sb, fd, n);
+    uint32_t ninode = bitmap_get_available_inode(sb, fd);
+    bitmap_set_inode_unavailable(sb, fd, ninode);
+
+    // the data goes first, so the inode only ever claims what was copied
+    int status = 0;
+    if (buf)
+        status = io_blocks_write(sb, fd, buf, blocks, ndata, size) ? 0 : -EIO;
+    else
+    {
+        off_t start = lseek(ifd, 0, SEEK_CUR);
+        if (!io_blocks_from(sb, fd, ifd, blocks, ndata, size))
+            status = -EIO;
+        else if (start != -1)
+        {
+            // a host file may end before its st_size says, e.g. in /sys
+            off_t end = lseek(ifd, 0, SEEK_CUR);
+            if (end != -1 && (uint64_t)(end - start) < size)
+                size = end - start;
+        }
+    }
+
+    struct s_inode* tmp;
+    inode_init(&tmp, ninode, node->ninode, to, '-');
+    tmp->size += size;
+
+    if (status == 0)
+        status = fs_dir_insert(sb, fd, node, tmp);
+
+    if (status != 0)
+    {
+        for (i = 0; i < n; ++i)
+            bitmap_set_available(sb, fd, blocks[i]);
+        bitmap_set_inode_available(sb, fd, ninode);
+
+        inode_del(tmp);
+        free(blocks);
+        return status;
+    }
+
+    dcache_set(sb, node->ninode, to, ninode, '-');
+
+    // blocks past a short copy, and the index blocks they needed, go back
+    uint32_t nused = (size + sb->block_size - 1) / sb->block_size;
+    uint32_t nindex = blockmap_get_overhead(sb, nused);
+    for (i = nused; i < ndata; ++i)
+        bitmap_set_available(sb, fd, blocks[i]);
+    for (i = ndata + nindex; i < n; ++i)
+        bitmap_set_available(sb, fd, blocks[i]);
+
+    fs_set_blocks(sb, fd, tmp, blocks, nused, blocks + ndata);
+
+    node->mtime = node->ctime = tmp->ctime;
+
+    inode_write(tmp, sb, fd, ninode);
+    inode_write(node, sb, fd, node->ninode);
+
+    fs_update_ancestors_size(sb, fd, tmp, tmp->size);
+
+    inode_del(tmp);
+    free(blocks);
+
+    return size;
+}
+
+int fs_pull(struct s_superblock* sb, int fd, struct s_inode* node, const char* from, const char* to)
+{
+    if (fs_find_ninode(sb, fd, node, to))
+        return -EEXIST;
+
+    int ifd = open(from, O_RDONLY);
+    if (ifd == -1)
+        return -errno;
+
+    struct stat st;
+    int64_t status = 0;
+    if (fstat(ifd, &st) == -1)
+        status = -errno;
+    else if (S_ISDIR(st.st_mode))
+        status = -EISDIR;
+    else
+        status = fs_pull_data(sb, fd, node, to, st.st_size, ifd, NULL);
+
+    close(ifd);
+    return status < 0 ? status : 0;
+}
+
+int fs_push(struct s_superblock* sb, int fd, struct s_inode* node, const char* to)
+{
+    if (node->type != '-')
+        return -EISDIR;
+
+    int ofd = open(to, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    if (ofd == -1)
+        return -errno;
+
+    uint32_t* blocks = blockmap_collect(sb, fd, node);
+    int ok = io_blocks_to(sb, fd, ofd, blocks, node->nblocks, node->size - INODE_SIZE);
+
+    node->atime = get_time_ns();
+    inode_write(node, sb, fd, node->ninode);
+
+    free(blocks);
+    close(ofd);
+
+    return ok ? 0 : -EIO;
+}
@@ -4,465 +4,182 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
 #include "superblock.h"
 #include "inode.h"
 #include "utils.h"
 #include "bitmap.h"
+#include "cache.h"
+#include "blockmap.h"
+#include "dirsize.h"
+#include "dcache.h"
+#include "journal.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-void fs_update_ancestors_size(struct s_superblock* sb, int fd, struct s_inode* node, int32_t size)
-{
-    struct s_inode* tmp;
-    inode_init(&tmp, 0, 0, "", 0);
-    inode_copy(tmp, node);
-
-    uint32_t offset;
-    while (tmp->parent_inode != 0)
-    {
-        offset = get_block_offset(sb, tmp->parent_inode);
-        inode_read(tmp, sb, fd, offset);
-        tmp->size += size;
-        inode_write(tmp, sb, fd, offset);
-    }
-
-    inode_del(tmp);
-}
-
-void fs_add_ninode(struct s_superblock* sb, int fd, struct s_inode* node, uint32_t nblock)
-{
-    if (node->iblock == 0 && node->nlast < 12)
-    {
-        node->blocks[node->nlast] = nblock;
-        ++(node->nlast);
-    }
-    else
-    {
-        uint32_t offset;
-        uint32_t* block = (uint32_t*)malloc(sb->block_size);
-
-        if (node->iblock == 0)
-        {
-            uint32_t iblock = bitmap_get_available_block(sb, fd);
-            bitmap_set_unavailable(sb, fd, iblock);
-
-            offset = get_block_offset(sb, iblock);
-
-            node->iblock = iblock;
-            node->nlast = 1;
-
-            block[0] = nblock;
-        }
-        else
-        {
-            offset = get_block_offset(sb, node->iblock);
-            pread(fd, block, sb->block_size, offset);
-
-            block[node->nlast] = nblock;
-            ++(node->nlast);
-        }
-
-        pwrite(fd, block, sb->block_size, offset);
-        free(block);
-    }
-}
-
-uint32_t fs_find_ninode(struct s_superblock* sb, int fd, struct s_inode* node, const char* name)
+uint32_t* fs_reserve_blocks(struct s_superblock* sb, int fd, uint32_t n);
+
+void fs_set_blocks(struct s_superblock* sb, int fd, struct s_inode* node, uint32_t* blocks, uint32_t n, uint32_t* spare);
+
+// Directory layout: block 0 of the directory is the hash index,
+//     [0] number of entries, [1..] head bucket block of each hash chain,
+// every further block is a bucket,
+//     [0] next bucket in the chain, [1] bytes used by entries, [2..] entries.
+// Every word and entry field is little-endian, like the inode fields.
+// Buckets are never given back until the directory itself is removed.
+#define DIR_HASH_OFFSET 2166136261u
+#define DIR_HASH_PRIME 16777619u
+
+#define DIR_BUCKET_HEAD (2 * sizeof(uint32_t))
+
+// Packed directory entry: the child's name, type and a copy of its size and
+// mtime, so ls and lookups never have to read the child inode.
+//
+//     0  ninode     4  size     8  type     9  name_len
+//    10  mtime     18  name[name_len]
+#define DIRENT_HEAD 18
+
+struct s_dirent
 {
-    struct s_inode* tmp;
-    inode_init(&tmp, 0, 0, "", '\0');
+    uint32_t ninode;
+    uint32_t size;
+    char type;
+    uint8_t name_len;
+    uint64_t mtime;
+    char name[NAME_LEN];
+};
 
-    uint32_t i, nblock = 0, len = (node->iblock ? 12 : node->nlast);
-    int not_found = 1;
-    for (i = 0; (i < len) && not_found; ++i)
-    {
-        inode_read(tmp, sb, fd, get_block_offset(sb, node->blocks[i]));
-        not_found = strncmp(tmp->name, name, NAME_LEN);
-    }
+uint32_t fs_dirent_decode(struct s_dirent* de, const uint8_t* buf);
 
-    if (node->iblock && not_found)
-    {
-        uint32_t* block = (uint32_t*)malloc(sb->block_size);
+uint32_t fs_dirent_encode(struct s_dirent* de, uint8_t* buf);
 
-        pread(fd, block, sb->block_size, get_block_offset(sb, node->iblock));
-        for (i = 0; (i < node->nlast) && not_found; ++i)
-        {
-            inode_read(tmp, sb, fd, get_block_offset(sb, block[i]));
-            not_found = strncmp(tmp->name, name, NAME_LEN);
-        }
+void fs_dirent_init(struct s_dirent* de, struct s_inode* node);
 
-        free(block);
-    }
+uint32_t fs_dir_hash(const char* name);
 
-    if (not_found == 0)
-        nblock = tmp->ninode;
+uint32_t fs_dir_get_nbuckets(struct s_superblock* sb);
 
-    inode_del(tmp);
+uint32_t fs_dir_get_head(struct s_superblock* sb, const uint8_t* index, const char* name);
 
-    return nblock;
-}
+uint32_t fs_dir_count(struct s_superblock* sb, int fd, struct s_inode* node);
 
-void fs_mkdir(struct s_superblock* sb, int fd, struct s_inode* node, const char* name)
-{
-    if (strlen(name) == 0)
-    {
-        puts("mkdir: empty directory name");
-        return;
-    }
+// Looks name up in the bucket chain starting at nblock. On success the
+// bucket is left in block, its number in *nbucket and the entry offset
+// inside it is returned; 0 means the name is not there.
+uint32_t fs_dir_lookup(struct s_superblock* sb, int fd, uint32_t nblock, const char* name, uint8_t* block, uint32_t* nbucket, struct s_dirent* de);
 
-    if ((sb->blocks_remain == 0) || (sb->blocks_remain == 1 && node->nlast == 12 && node->iblock == 0))
-    {
-        puts("mkdir: cannot create directory: no available space");
-        return;
-    }
+// Returns the inode name stands for in directory node and its type in *type,
+// 0 if there is none. fs_dir_find searches the directory itself, fs_lookup
+// asks the dentry cache first and tells it the answer.
+uint32_t fs_dir_find(struct s_superblock* sb, int fd, struct s_inode* node, const char* name, char* type);
 
-    if (node->iblock != 0 && node->nlast == sb->block_size / sizeof(uint32_t))
-    {
-        puts("mkdir: cannot create directory: max number of subdirectories/files reached");
-        return;
-    }
+uint32_t fs_lookup(struct s_superblock* sb, int fd, struct s_inode* node, const char* name, char* type);
 
-    uint32_t nblock = fs_find_ninode(sb, fd, node, name);
-    if (nblock)
-    {
-        puts("mkdir: cannot create directory: object exists");
-        return;
-    }
+uint32_t fs_find_ninode(struct s_superblock* sb, int fd, struct s_inode* node, const char* name);
 
-    nblock = bitmap_get_available_block(sb, fd);
-    printf("%d\n", nblock);
-    bitmap_set_unavailable(sb, fd, nblock);
+// Returns 0 on success, -ENOSPC if there is no space for a new bucket and
+// -EMLINK if the directory cannot address any more blocks.
+int fs_dir_insert(struct s_superblock* sb, int fd, struct s_inode* node, struct s_inode* child);
 
-    struct s_inode* dir;
-    inode_init(&dir, nblock, node->ninode, name, 'd');
+void fs_dir_remove(struct s_superblock* sb, int fd, struct s_inode* node, const char* name);
 
-    inode_write(dir, sb, fd, get_block_offset(sb, nblock));
+// Refreshes the size and mtime cached in child's entry of its parent
+// directory node.
+void fs_dir_set_size(struct s_superblock* sb, int fd, struct s_inode* node, struct s_inode* child);
 
-    fs_add_ninode(sb, fd, node, nblock);
-    inode_write(node, sb, fd, get_block_offset(sb, node->ninode));
+void fs_update_ancestors_size(struct s_superblock* sb, int fd, struct s_inode* node, int32_t size);
 
-    fs_update_ancestors_size(sb, fd, dir, dir->size);
+// Applies the pending directory size deltas: each touched directory gets
+// its inode and its entry in the parent written once.
+void fs_flush_sizes(struct s_superblock* sb, int fd);
 
-    inode_del(dir);
-}
+// The only way metadata is committed: applies the pending directory size
+// deltas, puts the bitmaps and the superblock into the cache and makes
+// everything dirty durable, as one journal transaction when there is a
+// journal. Only ever run between two operations, so the transaction holds
+// whole ones. Directory inodes held in memory by the caller keep their
+// pre-sync size and have to be read again afterwards. Returns 0 or -EIO.
+int fs_sync(struct s_superblock* sb, int fd);
 
-void fs_ls(struct s_superblock* sb, int fd, struct s_inode* node)
-{
-    if (node->iblock == 0 && node->nlast == 0)
-        return;
+// Errors are negative errno values; this is the wording for them. -ENFILE
+// stands for "no inode left" and -ENOTSUP for a host object that is neither
+// a regular file nor a directory.
+const char* fs_strerror(int error);
 
-    struct s_inode* tmp;
-    inode_init(&tmp, 0, 0, "", '\0');
-    uint32_t i, len = (node->iblock ? 12 : node->nlast);
+// Splits the next component off *path, skipping slashes. Returns its length,
+// 0 once the path is used up.
+uint32_t fs_path_next(const char** path, const char** name);
 
-    for (i = 0; i < len; ++i)
-    {
-        inode_read(tmp, sb, fd, get_block_offset(sb, node->blocks[i]));
+// Walks path from the root, with or without a leading slash; "." and ".."
+// are understood, ".." of the root being the root itself. On success node
+// holds the inode path names.
+int fs_resolve(struct s_superblock* sb, int fd, const char* path, struct s_inode* node);
 
-        printf("\t%c %s %10d %s\n", tmp->type, tmp->crtime, tmp->size, tmp->name);
-    }
+// Resolves everything but the last component of path into dir and copies
+// that component into name, NAME_LEN bytes.
+int fs_resolve_parent(struct s_superblock* sb, int fd, const char* path, struct s_inode* dir, char* name);
 
-    if (node->iblock)
-    {
-        uint32_t* block = (uint32_t*)malloc(sb->block_size);
+// Creates an empty file or directory name in node and returns its inode in
+// *ninode. Fails with -ENOSPC, -ENFILE, -EEXIST or -EMLINK; -ENOSPC only when
+// node has no room left for the entry, or for a directory on a full image.
+int fs_make_node(struct s_superblock* sb, int fd, struct s_inode* node, const char* name, char type, uint32_t* ninode);
 
-        pread(fd, block, sb->block_size, get_block_offset(sb, node->iblock));
-        for (i = 0; i < node->nlast; ++i)
-        {
-            inode_read(tmp, sb, fd, get_block_offset(sb, block[i]));
+int fs_make_dir(struct s_superblock* sb, int fd, struct s_inode* node, const char* name, uint32_t* ninode);
 
-            printf("\t%c %s %10d %s\n", tmp->type, tmp->crtime, tmp->size, tmp->name);
-        }
+// Called for every entry of a directory, in hash order, with the size of
+// subdirectories already including their pending changes. A non-zero
+// return stops the walk and is handed back by fs_readdir.
+typedef int (*fs_dir_fn)(void* arg, struct s_dirent* de);
 
-        free(block);
-    }
+int fs_readdir(struct s_superblock* sb, int fd, struct s_inode* node, fs_dir_fn fn, void* arg);
 
-    inode_del(tmp);
-}
+void fs_erase_file(struct s_superblock* sb, int fd, struct s_inode* node);
 
-uint32_t fs_cd(struct s_superblock* sb, int fd, struct s_inode* node, const char* name)
-{
-    if (strlen(name) == 0)
-    {
-        puts("cd: empty directory name");
-        return 0;
-    }
-
-    int up = strncmp(name, "..", 2);
-    if (up == 0 && node->parent_inode == 0)
-        return 1;
-
-    struct s_inode* tmp;
-    inode_init(&tmp, 0, 0, "", '\0');
-
-    uint32_t nblock = 0;
-    if (up == 0)
-    {
-        inode_read(tmp, sb, fd, get_block_offset(sb, node->parent_inode));
-        nblock = 1;
-    }
-    else if ((nblock = fs_find_ninode(sb, fd, node, name)) != 0)
-        inode_read(tmp, sb, fd, get_block_offset(sb, nblock));
-
-    if (nblock == 0 || tmp->type != 'd')
-    {
-        printf("cd: %s: no such directory\n", name);
-        nblock = 0;
-    }
-    else
-        inode_copy(node, tmp);
-
-    inode_del(tmp);
-
-    return nblock;
-}
-
-void fs_erase_file(struct s_superblock* sb, int fd, struct s_inode* node)
-{
-    uint32_t i, len = (node->iblock ? 12 : node->nlast);
-    for (i = 0; i < len; ++i)
-        bitmap_set_available(sb, fd, node->blocks[i]);
+// Removes name from node; directories only when they are empty.
+int fs_remove(struct s_superblock* sb, int fd, struct s_inode* node, const char* name);
 
-    if (node->iblock)
-    {
-        bitmap_set_available(sb, fd, node->iblock);
-        uint32_t* block = (uint32_t*)malloc(sb->block_size);
+// Moves len bytes at offset off of file node between buf and the image,
+// one request per run of adjacent blocks; the blocks have to be mapped
+// already. Writing from a NULL buf writes zeros. Returns 1 on success.
+int fs_move(struct s_superblock* sb, int fd, struct s_inode* node, uint8_t* buf, uint64_t len, uint64_t off, int write);
 
-        pread(fd, block, sb->block_size, get_block_offset(sb, node->iblock));
-        for (i = 0; i < node->nlast; ++i)
-            bitmap_set_available(sb, fd, block[i]);
+// Reads up to len bytes of file node starting at off. Returns the number of
+// bytes read, 0 at the end of the file.
+int64_t fs_pread(struct s_superblock* sb, int fd, struct s_inode* node, uint8_t* buf, uint64_t len, uint64_t off);
 
-        free(block);
-    }
-}
+// Sets the size of node and brings its entry in the parent and the pending
+// sizes of the ancestors along.
+void fs_resize(struct s_superblock* sb, int fd, struct s_inode* node, uint32_t size);
 
-void fs_rm(struct s_superblock* sb, int fd, struct s_inode* node, const char* name)
-{
-    if (strlen(name) == 0)
-    {
-        puts("rm: empty object name");
-        return;
-    }
-
-    struct s_inode* tmp;
-    inode_init(&tmp, 0, 0, "", '\0');
-
-    uint32_t nblock = fs_find_ninode(sb, fd, node, name);
-    if (nblock == 0)
-        printf("rm: %s: no such object\n", name);
-    else
-    {
-        inode_read(tmp, sb, fd, get_block_offset(sb, nblock));
-
-        if (tmp->type == '-')
-            fs_erase_file(sb, fd, tmp);
-        else if (tmp->nlast != 0)
-        {
-            puts("rm: cannot remove directory: directory is not empty");
-            inode_del(tmp);
-            return;
-        }
-
-        bitmap_set_available(sb, fd, nblock);
-
-        uint32_t i, offset, len = (node->iblock ? 12 : node->nlast);
-        for (i = 0; i < len && node->blocks[i] != nblock; ++i);
-
-        uint32_t* block;
-        if (node->iblock)
-        {
-            block = (uint32_t*)malloc(sb->block_size);
-            offset = get_block_offset(sb, node->iblock);
-            pread(fd, block, sb->block_size, offset);
-        }
-
-        if (i == len)
-        {
-            for (i = 0; i < node->nlast && block[i] != nblock; ++i);
-            for (; i < node->nlast - 1; ++i)
-                block[i] = block[i + 1];
-        }
-        else
-        {
-            for (; i < len - 1; ++i)
-                node->blocks[i] = node->blocks[i + 1];
-
-            if (node->iblock)
-            {
-                node->blocks[11] = block[0];
-                for (i = 0; i < node->nlast; ++i)
-                    block[i] = block[i + 1];
-            }
-        }
-
-        --(node->nlast);
-
-        if (node->iblock)
-        {
-            if (node->nlast == 0)
-            {
-                bitmap_set_available(sb, fd, node->iblock);
-                node->iblock = 0;
-                node->nlast = 12;
-            }
-            else
-                pwrite(fd, block, sb->block_size, offset);
-            free(block);
-        }
-
-        inode_write(node, sb, fd, get_block_offset(sb, node->ninode));
-
-        fs_update_ancestors_size(sb, fd, tmp, -(tmp->size));
-    }
-
-    inode_del(tmp);
-}
-
-uint32_t fs_get_available_file_space(struct s_superblock* sb)
-{
-    uint32_t primary = sb->blocks_remain - 1;
-    if (primary > 12)
-        primary = 12;
+// Maps data blocks for the first size bytes of node, in extents as long as
+// the bitmap has them, with their index blocks in one reservation.
+int fs_map(struct s_superblock* sb, int fd, struct s_inode* node, uint64_t size);
 
-    uint32_t secondary = sb->blocks_remain - primary - 2;
-    if (secondary < 0)
-        secondary = 0;
-    if (secondary > sb->block_size / sizeof(uint32_t))
-        secondary = sb->block_size / sizeof(uint32_t);
+// Writes len bytes of buf to file node at off, allocating whatever lies
+// past the end; a gap between the end and off is filled with zeros.
+// Returns len on success. On -EIO the length is left alone and the blocks
+// mapped on the way are given back.
+int64_t fs_pwrite(struct s_superblock* sb, int fd, struct s_inode* node, const uint8_t* buf, uint64_t len, uint64_t off);
 
-    return (primary + secondary) * sb->block_size;
-}
+// Cuts file node down to size bytes, giving back the blocks past it, or
+// extends it with zeros; a failed extension leaves the file as it was.
+int fs_truncate(struct s_superblock* sb, int fd, struct s_inode* node, uint64_t size);
 
-int fs_pull(struct s_superblock* sb, int fd, struct s_inode* node, const char* from, const char* to)
-{
-    if (strlen(from) == 0 || strlen(to) == 0)
-    {
-        puts("pull: empty file name(s)");
-        return 0;
-    }
-
-    if (fs_find_ninode(sb, fd, node, to))
-    {
-        printf("pull: cannot pull file %s: object exists\n", to);
-        return 0;
-    }
-
-    int ifd = open(from, O_RDONLY);
-    if (ifd == -1)
-    {
-        printf("pull: cannot open file %s\n", from);
-        return 0;
-    }
-
-    struct stat st;
-    fstat(ifd, &st);
-
-    uint32_t space = fs_get_available_file_space(sb);
-    if (st.st_size > space)
-    {
-        if (st.st_size > (sb->block_size / sizeof(uint32_t) + 12) * sb->block_size)
-            printf("pull: cannot pull file %s: file too large\n", from);
-        else
-            printf("pull: cannot pull file %s: no available space\n", from);
-        close(ifd);
-        return 0;
-    }
-
-    uint32_t nblock, tblock = bitmap_get_available_block(sb, fd);
-    bitmap_set_unavailable(sb, fd, tblock);
-
-    struct s_inode* tmp;
-    inode_init(&tmp, tblock, node->ninode, to, '-');
-    tmp->size += st.st_size;
-
-    fs_add_ninode(sb, fd, node, tblock);
-
-    char* block = (char*)malloc(sb->block_size);
-    int bytes = read(ifd, block, sb->block_size);
-    while (bytes > 0)
-    {
-        nblock = bitmap_get_available_block(sb, fd);
-        bitmap_set_unavailable(sb, fd, nblock);
-
-        pwrite(fd, block, bytes, get_block_offset(sb, nblock));
-        fs_add_ninode(sb, fd, tmp, nblock);
-
-        bytes = read(ifd, block, sb->block_size);
-    }
-
-    inode_write(tmp, sb, fd, get_block_offset(sb, tblock));
-    inode_write(node, sb, fd, get_block_offset(sb, node->ninode));
-
-    fs_update_ancestors_size(sb, fd, tmp, tmp->size);
-
-    close(ifd);
-    inode_del(tmp);
-    free(block);
-
-    return 1;
-}
-
-uint32_t fs_push(struct s_superblock* sb, int fd, struct s_inode* node, const char* from, const char* to)
-{
-    if (strlen(from) == 0 || strlen(to) == 0)
-    {
-        puts("push: empty file name(s)");
-        return 0;
-    }
-
-    uint32_t nblock = fs_find_ninode(sb, fd, node, from);
-
-    struct s_inode* tmp;
-    inode_init(&tmp, 0, 0, "", 0);
-    if (nblock)
-        inode_read(tmp, sb, fd, get_block_offset(sb, nblock));
-
-    if (nblock == 0 || tmp->type != '-')
-    {
-        printf("push: cannot push file %s: file does not exist\n");
-        inode_del(tmp);
-        return 0;
-    }
-
-    int ofd = open(from, O_CREAT | O_WRONLY, 0666);
-    if (ofd == -1)
-    {
-        printf("push: cannot open file %s\n", to);
-        inode_del(tmp);
-        return 0;
-    }
-
-    char* block = (char*)malloc(sb->block_size);
-    uint32_t i, len = (tmp->iblock ? 12 : tmp->nlast);
-    int32_t size = tmp->size - sb->block_size;
-    for (i = 0; (i < len) && (size > 0); ++i)
-    {
-        pread(fd, block, sb->block_size, get_block_offset(sb, tmp->blocks[i]));
-        write(ofd, block, (size < sb->block_size ? size : sb->block_size));
-        size -= sb->block_size;
-    }
-
-    if (tmp->iblock && size > 0)
-    {
-        uint32_t* iblock = (uint32_t*)malloc(sb->block_size);
-        pread(fd, iblock, sb->block_size, get_block_offset(sb, tmp->iblock));
-
-        for (i = 0; i < tmp->nlast && size > 0; ++i)
-        {
-            pread(fd, block, sb->block_size, get_block_offset(sb, iblock[i]));
-            write(ofd, block, (size < sb->block_size ? size : sb->block_size));
-            size -= sb->block_size;
-        }
-
-        free(iblock);
-    }
-
-    inode_del(tmp);
-    close(ofd);
-    free(block);
-
-    return 1;
-}
+// Sets the access and modification times of node, the copy of mtime in its
+// directory entry included.
+void fs_set_times(struct s_superblock* sb, int fd, struct s_inode* node, uint64_t atime, uint64_t mtime);
+
+// Creates file to in node with the size bytes of the host file: read from
+// ifd, or taken from buf when it is not NULL. Returns the length of the new
+// file, which is less than size if ifd ended early; on failure nothing is
+// created.
+int64_t fs_pull_data(struct s_superblock* sb, int fd, struct s_inode* node, const char* to, uint64_t size, int ifd, const uint8_t* buf);
+
+// Copies host file from into node as to.
+int fs_pull(struct s_superblock* sb, int fd, struct s_inode* node, const char* from, const char* to);
+
+// Copies file node out to host file to.
+int fs_push(struct s_superblock* sb, int fd, struct s_inode* node, const char* to);
 
 #endif // FS_H_INCLUDED
@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "options.h"
+#include "inode.h"
+#include "superblock.h"
+#include "bitmap.h"
+#include "blockmap.h"
+#include "journal.h"
+#include "pool.h"
+#include "utils.h"
+#include "fs.h"
+
+#define CHECK_REPORT_MAX 10
+
+// The image is read with plain pread only, no cache and no mapping, so any
+// number of workers can walk it at once. Each task checks one inode reached
+// through a directory entry and queues the entries of a directory as new
+// tasks. Blocks and inodes found in use are marked in bitmaps rebuilt in
+// memory, which are compared with the ones on disk at the end.
+struct s_check
+{
+    struct s_superblock* sb;
+    int fd;
+
+    uint8_t* blocks;
+    uint8_t* inodes;
+    uint32_t first_block;
+
+    uint64_t errors;
+    uint64_t ndirs;
+    uint64_t nfiles;
+    uint64_t nblocks;
+    uint64_t bytes;
+
+    pthread_mutex_t report;
+};
+
+// What the directory entry says about the inode it points to.
+struct s_check_task
+{
+    uint32_t ninode;
+    uint32_t parent;
+    uint32_t size;
+    char type;
+    char name[NAME_LEN];
+};
+
+void check_error(struct s_check* ck, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    pthread_mutex_lock(&ck->report);
+    vprintf(format, args);
+    pthread_mutex_unlock(&ck->report);
+
+    va_end(args);
+
+    __atomic_add_fetch(&ck->errors, 1, __ATOMIC_RELAXED);
+}
+
+// Sets bit n, returns whether it was set already.
+int check_mark(uint8_t* bits, uint32_t n)
+{
+    uint8_t mask = 1 << (BYTE - mod_base2(n, BYTE) - 1);
+    return (__atomic_fetch_or(bits + (n >> 3), mask, __ATOMIC_RELAXED) & mask) != 0;
+}
+
+int check_is_marked(const uint8_t* bits, uint32_t n)
+{
+    return (bits[n >> 3] & (1 << (BYTE - mod_base2(n, BYTE) - 1))) != 0;
+}
+
+int check_block(struct s_check* ck, uint32_t ninode, uint32_t nblock)
+{
+    if (nblock < ck->first_block || nblock >= ck->sb->blocks_total)
+    {
+        check_error(ck, "inode %u: block %u out of range\n", ninode, nblock);
+        return 0;
+    }
+
+    if (check_mark(ck->blocks, nblock))
+    {
+        check_error(ck, "inode %u: block %u is used twice\n", ninode, nblock);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Marks the index block nblock and everything below it; the data blocks of
+// the tree are appended to data.
+void check_tree(struct s_check* ck, uint32_t ninode, uint32_t nblock, uint32_t depth, uint32_t* data, uint32_t* n, uint32_t* left)
+{
+    if (*left == 0)
+        return;
+
+    if (nblock == 0)
+    {
+        check_error(ck, "inode %u: %u mapped blocks missing\n", ninode, *left);
+        *left = 0;
+        return;
+    }
+
+    if (!check_block(ck, ninode, nblock))
+    {
+        *left = 0;
+        return;
+    }
+
+    struct s_superblock* sb = ck->sb;
+    uint32_t i, p = blockmap_get_fanout(sb);
+    uint32_t* index = (uint32_t*)malloc(sb->block_size);
+
+    pread(ck->fd, index, sb->block_size, get_block_offset(sb, nblock));
+    __atomic_add_fetch(&ck->bytes, sb->block_size, __ATOMIC_RELAXED);
+
+    for (i = 0; i < p && *left; ++i)
+    {
+        if (depth > 1)
+            check_tree(ck, ninode, index[i], depth - 1, data, n, left);
+        else
+        {
+            if (index[i] && check_block(ck, ninode, index[i]))
+                data[(*n)++] = index[i];
+            else if (index[i] == 0)
+                check_error(ck, "inode %u: hole at block %u\n", ninode, *n);
+            --(*left);
+        }
+    }
+
+    free(index);
+}
+
+// Returns the data blocks of node that passed the checks, *n of them.
+uint32_t* check_blocks(struct s_check* ck, struct s_inode* node, uint32_t* n)
+{
+    uint32_t i, left = node->nblocks;
+    uint32_t* data = (uint32_t*)malloc((node->nblocks + 1) * sizeof(uint32_t));
+
+    *n = 0;
+    for (i = 0; i < 12 && left; ++i, --left)
+        if (node->blocks[i] && check_block(ck, node->ninode, node->blocks[i]))
+            data[(*n)++] = node->blocks[i];
+
+    check_tree(ck, node->ninode, node->iblock, 1, data, n, &left);
+    check_tree(ck, node->ninode, node->diblock, 2, data, n, &left);
+    check_tree(ck, node->ninode, node->tiblock, 3, data, n, &left);
+
+    __atomic_add_fetch(&ck->nblocks, node->nblocks, __ATOMIC_RELAXED);
+    return data;
+}
+
+void check_dir(struct s_pool* pool, uint32_t worker, struct s_inode* node, uint32_t* data, uint32_t n)
+{
+    struct s_check* ck = (struct s_check*)pool->ctx;
+    struct s_superblock* sb = ck->sb;
+
+    if (n == 0)
+    {
+        if (node->size != INODE_SIZE)
+            check_error(ck, "inode %u: empty directory has size %u\n", node->ninode, node->size);
+        return;
+    }
+
+    uint8_t* block = (uint8_t*)malloc(sb->block_size);
+    uint32_t i, off, end, count, entries = 0;
+    uint64_t size = INODE_SIZE;
+    struct s_dirent de;
+
+    pread(ck->fd, block, sb->block_size, get_block_offset(sb, data[0]));
+    count = inode_get32(block);
+
+    for (i = 1; i < n; ++i)
+    {
+        pread(ck->fd, block, sb->block_size, get_block_offset(sb, data[i]));
+
+        end = DIR_BUCKET_HEAD + inode_get32(block + 4);
+        if (end > sb->block_size)
+        {
+            check_error(ck, "inode %u: bucket %u overflows its block\n", node->ninode, data[i]);
+            continue;
+        }
+
+        for (off = DIR_BUCKET_HEAD; off + DIRENT_HEAD <= end; )
+        {
+            if (block[off + 9] >= NAME_LEN || off + DIRENT_HEAD + block[off + 9] > end)
+            {
+                check_error(ck, "inode %u: bad entry in bucket %u\n", node->ninode, data[i]);
+                break;
+            }
+
+            off += fs_dirent_decode(&de, block + off);
+            ++entries;
+            size += de.size;
+
+            if (de.ninode == 0 || de.ninode >= sb->inodes_total)
+            {
+                check_error(ck, "inode %u: entry %s points to bad inode %u\n", node->ninode, de.name, de.ninode);
+                continue;
+            }
+
+            struct s_check_task* task = (struct s_check_task*)malloc(sizeof(struct s_check_task));
+            task->ninode = de.ninode;
+            task->parent = node->ninode;
+            task->size = de.size;
+            task->type = de.type;
+            memcpy(task->name, de.name, NAME_LEN);
+
+            pool_push(pool, worker, task);
+        }
+    }
+
+    __atomic_add_fetch(&ck->bytes, (uint64_t)n * sb->block_size, __ATOMIC_RELAXED);
+
+    if (entries != count)
+        check_error(ck, "inode %u: directory holds %u entries, its index says %u\n", node->ninode, entries, count);
+    if (size != node->size)
+        check_error(ck, "inode %u: directory size %u, entries add up to %llu\n", node->ninode, node->size, (unsigned long long)size);
+
+    free(block);
+}
+
+void check_inode(struct s_pool* pool, uint32_t worker, void* arg)
+{
+    struct s_check* ck = (struct s_check*)pool->ctx;
+    struct s_check_task* task = (struct s_check_task*)arg;
+    struct s_superblock* sb = ck->sb;
+
+    if (check_mark(ck->inodes, task->ninode))
+    {
+        check_error(ck, "inode %u: %s is linked more than once\n", task->ninode, task->name);
+        free(task);
+        return;
+    }
+
+    struct s_inode* node;
+    inode_init(&node, 0, 0, "", 0);
+    inode_read(node, sb, ck->fd, task->ninode);
+    __atomic_add_fetch(&ck->bytes, INODE_SIZE, __ATOMIC_RELAXED);
+
+    if (node->parent_inode != task->parent)
+        check_error(ck, "inode %u: parent is %u, but it is listed in %u\n", node->ninode, node->parent_inode, task->parent);
+    if (node->type != task->type)
+        check_error(ck, "inode %u: type %c, its entry says %c\n", node->ninode, node->type, task->type);
+    if (strncmp(node->name, task->name, NAME_LEN) != 0)
+        check_error(ck, "inode %u: named %s, its entry says %s\n", node->ninode, node->name, task->name);
+    if (task->parent && node->size != task->size)
+        check_error(ck, "inode %u: size %u, its entry says %u\n", node->ninode, node->size, task->size);
+
+    uint32_t n;
+    uint32_t* data = check_blocks(ck, node, &n);
+
+    if (node->type == 'd')
+    {
+        __atomic_add_fetch(&ck->ndirs, 1, __ATOMIC_RELAXED);
+        check_dir(pool, worker, node, data, n);
+    }
+    else if (node->type == '-')
+    {
+        __atomic_add_fetch(&ck->nfiles, 1, __ATOMIC_RELAXED);
+
+        uint64_t len = node->size >= INODE_SIZE ? node->size - INODE_SIZE : 0;
+        if (node->size < INODE_SIZE || (len + sb->block_size - 1) / sb->block_size != node->nblocks)
+            check_error(ck, "inode %u: size %u does not match its %u blocks\n", node->ninode, node->size, node->nblocks);
+    }
+    else
+        check_error(ck, "inode %u: unknown type %d\n", node->ninode, node->type);
+
+    free(data);
+    inode_del(node);
+    free(task);
+}
+
+// Compares a rebuilt bitmap with the one on disk, returns the number of
+// differences.
+uint32_t check_bitmap(struct s_check* ck, const char* what, const uint8_t* rebuilt, struct s_bitmap* bm, uint32_t nbits)
+{
+    uint32_t i, lost = 0, leaked = 0;
+
+    for (i = 0; i < nbits; ++i)
+    {
+        int used = check_is_marked(rebuilt, i);
+        if (used == check_is_marked(bm->cells, i))
+            continue;
+
+        if (used)
+            ++lost;
+        else
+            ++leaked;
+
+        if (lost + leaked <= CHECK_REPORT_MAX)
+            printf("%s %u is %s\n", what, i, used ? "in use but marked free" : "marked in use but unreachable");
+    }
+
+    if (lost + leaked > CHECK_REPORT_MAX)
+        printf("... %u more %s bitmap differences\n", lost + leaked - CHECK_REPORT_MAX, what);
+
+    if (lost || leaked)
+        printf("%s bitmap: %u in use but free, %u leaked\n", what, lost, leaked);
+
+    return lost + leaked;
+}
+
+uint32_t check_count(const uint8_t* bits, uint32_t nbits)
+{
+    uint32_t i, n = 0;
+    for (i = 0; i < nbits; ++i)
+        n += check_is_marked(bits, i);
+
+    return n;
+}
+
+void usage()
+{
+    puts("usage: fs_check [-r] [-t threads] [image]\n\
+         \t-r: repair the block and inode bitmaps and the free counts\n\
+         \t-t: number of worker threads (default: one per core)\n\
+         \timage: image file to check (default fs)");
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t nthreads = pool_get_ncpus();
+    int repair = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "rt:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            repair = 1;
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    int fd = open(optind < argc ? argv[optind] : "fs", repair ? O_RDWR : O_RDONLY);
+    if (fd == -1)
+    {
+        perror("cannot open fs.img file");
+        return 1;
+    }
+
+    struct s_superblock* sb;
+    superblock_init(&sb, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    superblock_read(sb, fd);
+
+    if (!superblock_is_supported(sb))
+    {
+        printf("fs image has unsupported format revision %d (%d to %d can be read), recreate it with fs_init\n", sb->rev_level, REVISION_MIN, REVISION);
+        superblock_del(sb);
+        close(fd);
+        return 1;
+    }
+
+    // the image is only consistent once the journal is written home
+    if (repair)
+    {
+        uint64_t seq;
+        if (journal_replay(sb, fd, &seq) != 0)
+        {
+            puts("cannot replay the journal: it is left as it was, the image is not checked");
+            superblock_del(sb);
+            close(fd);
+            return 1;
+        }
+
+        if (seq)
+        {
+            puts("journal replayed");
+            lseek(fd, 0, SEEK_SET);
+            superblock_read(sb, fd);
+        }
+    }
+    else if (sb->journal_len)
+    {
+        uint32_t i, n;
+        uint64_t seq;
+        for (i = 0; i < 2; ++i)
+        {
+            uint8_t* buf = journal_read(sb, fd, i, &n, &seq);
+            if (buf)
+            {
+                puts("image was not unmounted cleanly, mount it or run with -r first");
+                free(buf);
+                break;
+            }
+        }
+    }
+
+    bitmap_load(sb, fd);
+
+    struct s_check ck;
+    ck.sb = sb;
+    ck.fd = fd;
+    ck.blocks = (uint8_t*)calloc(sb->bitmap->ncells, 1);
+    ck.inodes = (uint8_t*)calloc(sb->inode_bitmap->ncells, 1);
+    ck.first_block = sb->journal_block + sb->journal_len;
+    ck.errors = 0;
+    ck.ndirs = 0;
+    ck.nfiles = 0;
+    ck.nblocks = 0;
+    ck.bytes = 0;
+    pthread_mutex_init(&ck.report, NULL);
+
+    uint32_t i;
+    for (i = 0; i < ck.first_block; ++i)
+        check_mark(ck.blocks, i);
+    check_mark(ck.inodes, 0);
+
+    struct s_check_task* root = (struct s_check_task*)malloc(sizeof(struct s_check_task));
+    root->ninode = sb->root_inode;
+    root->parent = 0;
+    root->size = 0;
+    root->type = 'd';
+    strcpy(root->name, "/");
+
+    uint64_t start = get_time_ns();
+
+    struct s_pool* pool;
+    pool_init(&pool, nthreads, check_inode, &ck);
+    pool_push(pool, 0, root);
+    pool_run(pool);
+
+    uint64_t elapsed = get_time_ns() - start;
+
+    uint32_t used = check_count(ck.blocks, sb->blocks_total);
+    uint32_t inodes_used = check_count(ck.inodes, sb->inodes_total);
+    uint32_t diffs = check_bitmap(&ck, "block", ck.blocks, sb->bitmap, sb->blocks_total);
+    diffs += check_bitmap(&ck, "inode", ck.inodes, sb->inode_bitmap, sb->inodes_total);
+
+    if (sb->blocks_remain != sb->blocks_total - used)
+    {
+        printf("superblock: %u blocks free, %u actually\n", sb->blocks_remain, sb->blocks_total - used);
+        ++diffs;
+    }
+    if (sb->inodes_remain != sb->inodes_total - inodes_used)
+    {
+        printf("superblock: %u inodes free, %u actually\n", sb->inodes_remain, sb->inodes_total - inodes_used);
+        ++diffs;
+    }
+
+    if (repair && diffs)
+    {
+        pwrite(fd, ck.blocks, sb->bitmap->ncells, sb->bitmap_offset);
+        pwrite(fd, ck.inodes, sb->inode_bitmap->ncells, sb->inode_bitmap_offset);
+
+        sb->blocks_remain = sb->blocks_total - used;
+        sb->inodes_remain = sb->inodes_total - inodes_used;
+        superblock_sync(sb, fd);
+        fdatasync(fd);
+
+        printf("repaired %u bitmap and count differences\n", diffs);
+        diffs = 0;
+    }
+
+    double sec = elapsed / 1e9;
+    printf("%llu directories, %llu files, %llu blocks; %llu errors, %u bitmap differences\n",
+           (unsigned long long)ck.ndirs, (unsigned long long)ck.nfiles, (unsigned long long)ck.nblocks,
+           (unsigned long long)ck.errors, diffs);
+    printf("checked in %.3f s with %u threads (%llu steals): %.0f inodes/s, %.1f MiB/s of metadata\n",
+           sec, pool->nthreads, (unsigned long long)pool->steals,
+           (ck.ndirs + ck.nfiles) / (sec > 0 ? sec : 1e-9), ck.bytes / 1048576.0 / (sec > 0 ? sec : 1e-9));
+
+    pool_del(pool);
+    pthread_mutex_destroy(&ck.report);
+    free(ck.blocks);
+    free(ck.inodes);
+    bitmap_unload(sb);
+    superblock_del(sb);
+    close(fd);
+
+    return ck.errors || diffs;
+}
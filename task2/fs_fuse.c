@@ -0,0 +1,435 @@
+#define FUSE_USE_VERSION 31
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <fuse.h>
+#include "minifs.h"
+
+// FUSE frontend: serves the image as a native directory tree.
+//
+// Requests are served one at a time. A mount handle takes one call at a time,
+// and even a read or a lookup changes shared state (block and dentry caches,
+// atime, the statistics), so every request, reads included, runs under
+// fusefs_lock. The multithreaded loop only keeps requests queued between the
+// kernel and the daemon; parallel readers of the mount do not read in parallel.
+struct s_fusefs_options
+{
+    char* image;
+    int mmap;
+    int uring;
+};
+
+const struct fuse_opt fusefs_options[] = {
+    {"--image=%s", offsetof(struct s_fusefs_options, image), 1},
+    {"--mmap", offsetof(struct s_fusefs_options, mmap), 1},
+    {"--uring", offsetof(struct s_fusefs_options, uring), 1},
+    FUSE_OPT_END};
+
+pthread_mutex_t fusefs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// NULL only when init could not mount the image and the loop is shutting down
+struct minifs* fusefs_get_fs()
+{
+    return (struct minifs*)fuse_get_context()->private_data;
+}
+
+// Errors come as negative errno values already; only "no inode left" has
+// no errno of its own and reads as a full filesystem.
+int fusefs_error(int error)
+{
+    return error == -ENFILE ? -ENOSPC : error;
+}
+
+struct timespec fusefs_get_time(uint64_t ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    return ts;
+}
+
+uint64_t fusefs_get_ns(const struct timespec* ts, uint64_t now, uint64_t old)
+{
+    if (ts->tv_nsec == UTIME_OMIT)
+        return old;
+    if (ts->tv_nsec == UTIME_NOW)
+        return now;
+
+    return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+void fusefs_fill_stat(struct stat* st, const struct minifs_stat* ms, uint32_t block_size)
+{
+    memset(st, 0, sizeof(struct stat));
+
+    st->st_ino = ms->ino;
+    st->st_mode = ms->type == 'd' ? S_IFDIR | 0755 : S_IFREG | 0644;
+    st->st_nlink = ms->type == 'd' ? 2 : 1;
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_size = ms->size;
+    st->st_blksize = block_size;
+    st->st_blocks = (uint64_t)ms->nblocks * block_size / 512;
+
+    st->st_atim = fusefs_get_time(ms->atime);
+    st->st_mtim = fusefs_get_time(ms->mtime);
+    st->st_ctim = fusefs_get_time(ms->ctime);
+}
+
+// The image is mounted here rather than in main: fuse_main forks into the
+// background before the loop starts, and the io_uring and the mapping of the
+// image belong in the process that serves the requests.
+void* fusefs_init(struct fuse_conn_info* conn, struct fuse_config* cfg)
+{
+    struct fuse_context* ctx = fuse_get_context();
+    struct s_fusefs_options* opts = (struct s_fusefs_options*)ctx->private_data;
+
+    // inode numbers are stable, and nobody else writes to the image
+    cfg->use_ino = 1;
+    cfg->kernel_cache = 1;
+
+    int flags = 0;
+    if (opts->mmap)
+        flags |= MINIFS_MMAP;
+    else if (opts->uring)
+        flags |= MINIFS_URING;
+
+    struct minifs* fs;
+    int status = minifs_mount(opts->image, flags, &fs);
+    if (status != 0)
+    {
+        fprintf(stderr, "fs_fuse: cannot mount %s: %s\n", opts->image, minifs_strerror(status));
+        fuse_exit(ctx->fuse);
+        return NULL;
+    }
+
+    return fs;
+}
+
+void fusefs_destroy(void* data)
+{
+    if (data == NULL)
+        return;
+
+    int status = minifs_unmount((struct minifs*)data);
+    if (status != 0)
+        fprintf(stderr, "fs_fuse: cannot unmount the image: %s\n", minifs_strerror(status));
+}
+
+int fusefs_getattr(const char* path, struct stat* st, struct fuse_file_info* fi)
+{
+    struct minifs* fs = fusefs_get_fs();
+    if (fs == NULL)
+        return -EIO;
+
+    struct minifs_stat ms;
+    struct minifs_statfs sfs;
+
+    pthread_mutex_lock(&fusefs_lock);
+    int status = fi ? minifs_fstat((struct minifs_file*)(uintptr_t)fi->fh, &ms) : minifs_stat(fs, path, &ms);
+    minifs_statfs(fs, &sfs);
+    pthread_mutex_unlock(&fusefs_lock);
+
+    if (status == 0)
+        fusefs_fill_stat(st, &ms, sfs.block_size);
+
+    return fusefs_error(status);
+}
+
+struct s_fusefs_readdir
+{
+    void* buf;
+    fuse_fill_dir_t filler;
+};
+
+int fusefs_readdir_entry(void* arg, const struct minifs_dirent* de)
+{
+    struct s_fusefs_readdir* rd = (struct s_fusefs_readdir*)arg;
+    struct stat st;
+
+    memset(&st, 0, sizeof(struct stat));
+    st.st_ino = de->ino;
+    st.st_mode = de->type == 'd' ? S_IFDIR : S_IFREG;
+
+    // a full buffer ends the listing, the kernel asks again for the rest
+    return rd->filler(rd->buf, de->name, &st, 0, 0) ? 1 : 0;
+}
+
+int fusefs_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t off, struct fuse_file_info* fi, enum fuse_readdir_flags flags)
+{
+    struct minifs* fs = fusefs_get_fs();
+    if (fs == NULL)
+        return -EIO;
+
+    struct s_fusefs_readdir rd;
+    rd.buf = buf;
+    rd.filler = filler;
+
+    filler(buf, ".", NULL, 0, 0);
+    filler(buf, "..", NULL, 0, 0);
+
+    pthread_mutex_lock(&fusefs_lock);
+    int status = minifs_readdir(fs, path, fusefs_readdir_entry, &rd);
+    pthread_mutex_unlock(&fusefs_lock);
+
+    return status > 0 ? 0 : fusefs_error(status);
+}
+
+int fusefs_get_flags(int flags)
+{
+    int mflags = 0;
+
+    if ((flags & O_ACCMODE) != O_WRONLY)
+        mflags |= MINIFS_READ;
+    if ((flags & O_ACCMODE) != O_RDONLY)
+        mflags |= MINIFS_WRITE;
+    if (flags & O_CREAT)
+        mflags |= MINIFS_CREATE;
+    if (flags & O_EXCL)
+        mflags |= MINIFS_EXCL;
+    if (flags & O_TRUNC)
+        mflags |= MINIFS_TRUNC;
+    if (flags & O_APPEND)
+        mflags |= MINIFS_APPEND;
+
+    return mflags;
+}
+
+int fusefs_open(const char* path, struct fuse_file_info* fi)
+{
+    struct minifs* fs = fusefs_get_fs();
+    if (fs == NULL)
+        return -EIO;
+
+    struct minifs_file* file;
+
+    pthread_mutex_lock(&fusefs_lock);
+    int status = minifs_open(fs, path, fusefs_get_flags(fi->flags), &file);
+    pthread_mutex_unlock(&fusefs_lock);
+
+    if (status == 0)
+        fi->fh = (uint64_t)(uintptr_t)file;
+
+    return fusefs_error(status);
+}
+
+int fusefs_create(const char* path, mode_t mode, struct fuse_file_info* fi)
+{
+    fi->flags |= O_CREAT;
+    return fusefs_open(path, fi);
+}
+
+int fusefs_read(const char* path, char* buf, size_t len, off_t off, struct fuse_file_info* fi)
+{
+    pthread_mutex_lock(&fusefs_lock);
+    ssize_t n = minifs_pread((struct minifs_file*)(uintptr_t)fi->fh, buf, len, off);
+    pthread_mutex_unlock(&fusefs_lock);
+
+    return n;
+}
+
+int fusefs_write(const char* path, const char* buf, size_t len, off_t off, struct fuse_file_info* fi)
+{
+    pthread_mutex_lock(&fusefs_lock);
+    ssize_t n = minifs_pwrite((struct minifs_file*)(uintptr_t)fi->fh, buf, len, off);
+    pthread_mutex_unlock(&fusefs_lock);
+
+    return n < 0 ? fusefs_error(n) : n;
+}
+
+int fusefs_truncate(const char* path, off_t size, struct fuse_file_info* fi)
+{
+    struct minifs* fs = fusefs_get_fs();
+    if (fs == NULL)
+        return -EIO;
+
+    pthread_mutex_lock(&fusefs_lock);
+    int status = fi ? minifs_ftruncate((struct minifs_file*)(uintptr_t)fi->fh, size) : minifs_truncate(fs, path, size);
+    pthread_mutex_unlock(&fusefs_lock);
+
+    return fusefs_error(status);
+}
+
+int fusefs_utimens(const char* path, const struct timespec tv[2], struct fuse_file_info* fi)
+{
+    struct minifs* fs = fusefs_get_fs();
+    if (fs == NULL)
+        return -EIO;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+    struct minifs_stat ms;
+
+    pthread_mutex_lock(&fusefs_lock);
+    int status = minifs_stat(fs, path, &ms);
+    if (status == 0)
+        status = minifs_utimens(fs, path, fusefs_get_ns(tv, ns, ms.atime), fusefs_get_ns(tv + 1, ns, ms.mtime));
+    pthread_mutex_unlock(&fusefs_lock);
+
+    return fusefs_error(status);
+}
+
+int fusefs_release(const char* path, struct fuse_file_info* fi)
+{
+    pthread_mutex_lock(&fusefs_lock);
+    minifs_close((struct minifs_file*)(uintptr_t)fi->fh);
+    pthread_mutex_unlock(&fusefs_lock);
+
+    return 0;
+}
+
+int fusefs_fsync(const char* path, int datasync, struct fuse_file_info* fi)
+{
+    struct minifs* fs = fusefs_get_fs();
+    if (fs == NULL)
+        return -EIO;
+
+    pthread_mutex_lock(&fusefs_lock);
+    int status = minifs_sync(fs);
+    pthread_mutex_unlock(&fusefs_lock);
+
+    return status;
+}
+
+int fusefs_mkdir(const char* path, mode_t mode)
+{
+    struct minifs* fs = fusefs_get_fs();
+    if (fs == NULL)
+        return -EIO;
+
+    pthread_mutex_lock(&fusefs_lock);
+    int status = minifs_mkdir(fs, path);
+    pthread_mutex_unlock(&fusefs_lock);
+
+    return fusefs_error(status);
+}
+
+// unlink and rmdir both end in minifs_remove, each only for its own type
+int fusefs_remove(const char* path, char type)
+{
+    struct minifs* fs = fusefs_get_fs();
+    if (fs == NULL)
+        return -EIO;
+
+    struct minifs_stat ms;
+
+    pthread_mutex_lock(&fusefs_lock);
+    int status = minifs_stat(fs, path, &ms);
+    if (status == 0 && ms.type != type)
+        status = type == 'd' ? -ENOTDIR : -EISDIR;
+    else if (status == 0)
+        status = minifs_remove(fs, path);
+    pthread_mutex_unlock(&fusefs_lock);
+
+    return fusefs_error(status);
+}
+
+int fusefs_unlink(const char* path)
+{
+    return fusefs_remove(path, '-');
+}
+
+int fusefs_rmdir(const char* path)
+{
+    return fusefs_remove(path, 'd');
+}
+
+int fusefs_statfs(const char* path, struct statvfs* st)
+{
+    struct minifs* fs = fusefs_get_fs();
+    if (fs == NULL)
+        return -EIO;
+
+    struct minifs_statfs sfs;
+
+    pthread_mutex_lock(&fusefs_lock);
+    minifs_statfs(fs, &sfs);
+    pthread_mutex_unlock(&fusefs_lock);
+
+    memset(st, 0, sizeof(struct statvfs));
+    st->f_bsize = sfs.block_size;
+    st->f_frsize = sfs.block_size;
+    st->f_blocks = sfs.blocks_total;
+    st->f_bfree = sfs.blocks_free;
+    st->f_bavail = sfs.blocks_free;
+    st->f_files = sfs.inodes_total;
+    st->f_ffree = sfs.inodes_free;
+    st->f_favail = sfs.inodes_free;
+    st->f_namemax = MINIFS_NAME_MAX;
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct s_fusefs_options opts;
+    memset(&opts, 0, sizeof(opts));
+
+    if (fuse_opt_parse(&args, &opts, fusefs_options, NULL) == -1)
+        return 1;
+
+    if (opts.image == NULL)
+    {
+        puts("usage: fs_fuse --image=<image> [--mmap | --uring] [FUSE options] <mountpoint>\n\
+         \t--mmap: access the image through mmap instead of pread/pwrite\n\
+         \t--uring: batch block I/O on an io_uring (pread/pwrite if unavailable)\n\
+         \t-f: stay in the foreground, -s: single-threaded loop, see fuse(8) for the rest\n\
+         \trequests are served one at a time, concurrent readers of the mount wait for each other");
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+
+    // the image is mounted by init, once in the background and in "/", so
+    // it is named by its absolute path; the common mistakes are still
+    // reported here, where they can be seen
+    char* image = realpath(opts.image, NULL);
+    if (image == NULL || access(image, R_OK | W_OK) != 0)
+    {
+        printf("cannot mount %s: %s\n", opts.image, strerror(errno));
+        free(image);
+        free(opts.image);
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+
+    free(opts.image);
+    opts.image = image;
+
+    struct fuse_operations ops;
+    memset(&ops, 0, sizeof(ops));
+    ops.init = fusefs_init;
+    ops.destroy = fusefs_destroy;
+    ops.getattr = fusefs_getattr;
+    ops.readdir = fusefs_readdir;
+    ops.open = fusefs_open;
+    ops.create = fusefs_create;
+    ops.read = fusefs_read;
+    ops.write = fusefs_write;
+    ops.truncate = fusefs_truncate;
+    ops.utimens = fusefs_utimens;
+    ops.release = fusefs_release;
+    ops.fsync = fusefs_fsync;
+    ops.mkdir = fusefs_mkdir;
+    ops.unlink = fusefs_unlink;
+    ops.rmdir = fusefs_rmdir;
+    ops.statfs = fusefs_statfs;
+
+    // init mounts the image and destroy unmounts it once the loop is done
+    int status = fuse_main(args.argc, args.argv, &ops, &opts);
+
+    free(opts.image);
+    fuse_opt_free_args(&args);
+    return status;
+}
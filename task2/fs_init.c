@@ -3,6 +3,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <errno.h>
 #include "options.h"
 #include "inode.h"
 #include "superblock.h"
@@ -12,56 +15,162 @@
 
 void fs_mkroot(struct s_superblock* sb, int fd)
 {
-    int32_t nblock = bitmap_get_available_block(sb, fd);
+    // inode 0 means "no inode" and is never handed out
+    bitmap_set_inode_unavailable(sb, fd, 0);
 
-    bitmap_set_unavailable(sb, fd, nblock);
+    uint32_t ninode = bitmap_get_available_inode(sb, fd);
+    bitmap_set_inode_unavailable(sb, fd, ninode);
+    sb->root_inode = ninode;
 
     struct s_inode* dir;
-    inode_init(&dir, nblock, 0, "/", 'd');
-
-    uint32_t offset = get_block_offset(sb, nblock);
-    inode_write(dir, sb, fd, offset);
+    inode_init(&dir, ninode, 0, "/", 'd');
+    inode_write(dir, sb, fd, ninode);
 
     inode_del(dir);
 }
 
-void flush_blocks(struct s_superblock* sb, int fd, uint32_t br, uint32_t pr)
+// Reserves every block of the image on disk up front, writing zeros where
+// the filesystem cannot allocate without doing so.
+int preallocate_blocks(struct s_superblock* sb, int fd)
 {
-    uint8_t* buf = (uint8_t*)malloc(br * sizeof(uint8_t));
+    errno = posix_fallocate(fd, 0, get_block_offset(sb, sb->blocks_total));
+    return errno == 0;
+}
 
-    memset(buf, 0, br * sizeof(uint8_t));
-    write(fd, buf, br * sizeof(uint8_t));
+uint64_t parse_size(const char* arg)
+{
+    char* end;
+    uint64_t size = strtoull(arg, &end, 10);
 
-    buf = (uint8_t*)realloc(buf, sb->block_size * sizeof(uint8_t));
-    memset(buf, 0, sb->block_size * sizeof(uint8_t));
-    for (; pr; --pr)
-        write(fd, buf, sb->block_size * sizeof(uint8_t));
+    switch (toupper(*end))
+    {
+    case 'G':
+        size <<= 10;
+        // fall through
+    case 'M':
+        size <<= 10;
+        // fall through
+    case 'K':
+        size <<= 10;
+    }
+
+    return size;
+}
 
-    free(buf);
+void usage()
+{
+    puts("usage: fs_init [-b block_size] [-s image_size] [-i bytes_per_inode] [-j journal_size] [--preallocate] [image]\n\
+         \t-b: block size in bytes, a power of two from 512 to 64K (default 4K)\n\
+         \t-s: image size, K/M/G suffixes allowed (default 128M)\n\
+         \t-i: one inode per that many bytes of image (default 4K)\n\
+         \t-j: metadata journal size, at most an eighth of the image, 0 for none (default 4M)\n\
+         \t--preallocate: allocate every block on disk instead of creating a sparse image\n\
+         \timage: image file to create (default fs)");
 }
 
-int main()
+int main(int argc, char** argv)
 {
-    int fd = open("fs", O_CREAT | O_RDWR, 0666);
+    uint64_t block_size = BLOCK_SIZE, image_size = IMAGE_SIZE, ratio = INODE_RATIO, journal_size = JOURNAL_SIZE;
+
+    int prealloc = 0;
+
+    struct option longopts[] = {
+        { "preallocate", no_argument, NULL, 'p' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:s:i:j:p", longopts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            block_size = parse_size(optarg);
+            break;
+        case 's':
+            image_size = parse_size(optarg);
+            break;
+        case 'i':
+            ratio = parse_size(optarg);
+            break;
+        case 'j':
+            journal_size = parse_size(optarg);
+            break;
+        case 'p':
+            prealloc = 1;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (block_size < BLOCK_SIZE_MIN || block_size > BLOCK_SIZE_MAX || (block_size & (block_size - 1)))
+    {
+        puts("fs_init: block size must be a power of two from 512 to 64K");
+        return 1;
+    }
+
+    // whole bytes of bitmap only, and block numbers must fit in 32 bits
+    uint64_t blocks_total = (image_size / block_size) & ~7ULL;
+    if (blocks_total > UINT32_MAX)
+        blocks_total = UINT32_MAX & ~7U;
+
+    if (ratio < block_size)
+        ratio = block_size;
+
+    // two journal halves of a few blocks at least, or no journal
+    uint64_t journal_len = journal_size / block_size;
+    if (journal_len > blocks_total / 8)
+        journal_len = blocks_total / 8;
+    journal_len &= ~1ULL;
+    if (journal_len < 4)
+        journal_len = 0;
+
+    // superblock, block bitmap and inode bitmap, then the inode table and the journal
+    uint64_t inodes_total = ((blocks_total * block_size / ratio) + 7) & ~7ULL;
+    uint64_t inode_bitmap_offset = SUPER_SIZE + (blocks_total >> 3);
+    uint64_t inode_table = (inode_bitmap_offset + (inodes_total >> 3) + block_size - 1) / block_size;
+    uint64_t journal_block = inode_table + (inodes_total * INODE_SIZE + block_size - 1) / block_size;
+    uint64_t block_offset = journal_block + journal_len;
+    if (inodes_total < 8 || blocks_total < block_offset + 1)
+    {
+        puts("fs_init: image size too small for this block size");
+        return 1;
+    }
+
+    const char* path = optind < argc ? argv[optind] : "fs";
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
     if (fd == -1)
     {
         perror("cannot create fs.img file");
         return 1;
     }
 
-    uint32_t block_offset = (sizeof(struct s_superblock) + (BLOCKS_TOTAL >> 3) + BLOCK_SIZE - 1) >> 7;
-
     struct s_superblock* sb;
-    superblock_init(&sb, BLOCKS_TOTAL, BLOCKS_TOTAL - block_offset, BLOCK_SIZE, sizeof(struct s_inode), sizeof(struct s_superblock), block_offset, MAGIC);
+    superblock_init(&sb, blocks_total, blocks_total - block_offset, block_size, INODE_SIZE, SUPER_SIZE, 0, MAGIC, REVISION, inodes_total, inodes_total, inode_bitmap_offset, inode_table, journal_block, journal_len);
+
+    // unwritten blocks of the image stay holes and read back as zeros
+    if (ftruncate(fd, get_block_offset(sb, blocks_total)) == -1 || (prealloc && !preallocate_blocks(sb, fd)))
+    {
+        perror("cannot allocate fs.img file");
+        superblock_del(sb);
+        close(fd);
+        return 1;
+    }
 
     superblock_write(sb, fd);
 
-    bitmap_write(fd, block_offset, BLOCKS_TOTAL);
+    bitmap_write(sb, fd, block_offset);
 
-    flush_blocks(sb, fd, sb->block_size - sizeof(struct s_superblock), sb->blocks_remain);
+    bitmap_load(sb, fd);
 
     fs_mkroot(sb, fd);
 
+    bitmap_flush(sb, fd);
+    superblock_sync(sb, fd);
+
+    bitmap_unload(sb);
     superblock_del(sb);
     close(fd);
 
@@ -1,118 +1,408 @@
 #include <stdio.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
-#include "superblock.h"
-#include "inode.h"
-#include "fs.h"
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include "minifs.h"
 
-void run_shell(struct s_superblock* sb, int fd, struct s_inode* root)
-{
-    uint8_t i, j, len;
-    char path[2000] = "/";
-    char cmd[100], arg1[NAME_LEN], arg2[NAME_LEN];
+#define SHELL_ARGS 4
+#define SHELL_PATH 4096
 
-    puts("MiniFS Shell. Supported commands:\n\
-         \tls: display current directory content (with metadata)\n\
+void print_help()
+{
+    puts("MiniFS Shell. Names in the image may be paths, absolute or relative to the current directory. Supported commands:\n\
+         \tls [-t] [dir_name]: display current directory content (with metadata), -t: newest first\n\
          \tmkdir <dir_name>: create new directory with name <dir_name> (in current directory)\n\
          \trm <iname>: remove directory/file with name <iname> (in current directory);\n\
          \t\t\tif directory, remove succeeds if (and only if) the directory was empty\
          \tcd <dir_name>: change current directory to <dir_name>\n\
          \tpull <source> <dest>: copy content from native FS <source> to <dest>\n\
+         \tpull -r <source> <dest>: copy directory tree <source> from native FS to new directory <dest>\n\
          \tpush <source> <dest>: copy content from <source> to native FS <dest>\n\
+         \tpush -r <source> <dest>: copy directory tree <source> (. for the current one) to new native FS directory <dest>\n\
+         \tsync: write cached metadata back to the image and show cache statistics\n\
          \texit: exit shell");
+}
 
-    for (;;)
-    {
-        printf("%s$ ", path);
-        fgets(cmd, 100, stdin);
-        len = strlen(cmd);
-        if (strncmp(cmd, "exit", len - 1) == 0 && len == 5)
-            break;
+// Resolves name against the current directory cwd into an absolute path
+// without "." and ".." components, ending in a slash like cwd itself.
+// Returns 0 if the result does not fit into SHELL_PATH.
+int shell_join(char* out, const char* cwd, const char* name)
+{
+    char buf[2 * SHELL_PATH];
+    snprintf(buf, sizeof(buf), "%s/%s", name[0] == '/' ? "" : cwd, name);
 
-        for (i = 0; i < len && !isspace(cmd[i]); ++i);
+    uint32_t len = 1, n;
+    char* save;
+    char* comp = strtok_r(buf, "/", &save);
+    strcpy(out, "/");
 
-        if (i == len && len > 3)
+    for (; comp; comp = strtok_r(NULL, "/", &save))
+    {
+        n = strlen(comp);
+        if (strcmp(comp, ".") == 0)
+            continue;
+
+        if (strcmp(comp, "..") == 0)
         {
-            puts("unknown command");
+            // drop the last component, keeping the trailing slash
+            if (len > 1)
+                for (out[--len] = 0; out[len - 1] != '/'; --len)
+                    out[len - 1] = 0;
             continue;
         }
 
-        j = i;
-        for (++i; i < len && !isspace(cmd[i]); ++i);
+        if (len + n + 1 >= SHELL_PATH)
+            return 0;
+
+        memcpy(out + len, comp, n);
+        len += n;
+        out[len++] = '/';
+        out[len] = 0;
+    }
+
+    return 1;
+}
+
+struct s_shell_list
+{
+    struct minifs_dirent* entries;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+void shell_ls_print(const struct minifs_dirent* de)
+{
+    char mtime[32];
+    time_t sec = de->mtime / 1000000000ULL;
+    struct tm tm;
+
+    strftime(mtime, sizeof(mtime), "%a %b %e %H:%M:%S %Y", localtime_r(&sec, &tm));
+
+    printf("\t%c %s %10llu %s\n", de->type, mtime, (unsigned long long)de->usage, de->name);
+}
+
+int shell_ls_entry(void* arg, const struct minifs_dirent* de)
+{
+    struct s_shell_list* list = (struct s_shell_list*)arg;
+    if (list == NULL)
+    {
+        shell_ls_print(de);
+        return 0;
+    }
+
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? 2 * list->capacity : 64;
+        list->entries = (struct minifs_dirent*)realloc(list->entries, list->capacity * sizeof(struct minifs_dirent));
+    }
+    list->entries[list->count++] = *de;
+
+    return 0;
+}
+
+int shell_ls_cmp_mtime(const void* a, const void* b)
+{
+    const struct minifs_dirent* x = (const struct minifs_dirent*)a;
+    const struct minifs_dirent* y = (const struct minifs_dirent*)b;
+
+    return (x->mtime < y->mtime) - (x->mtime > y->mtime);
+}
+
+// Lists path in hash order, or newest first when by_time is set.
+int shell_ls(struct minifs* fs, const char* path, int by_time)
+{
+    if (!by_time)
+        return minifs_readdir(fs, path, shell_ls_entry, NULL);
+
+    struct s_shell_list list;
+    list.entries = NULL;
+    list.count = 0;
+    list.capacity = 0;
+
+    int status = minifs_readdir(fs, path, shell_ls_entry, &list);
+
+    uint32_t i;
+    qsort(list.entries, list.count, sizeof(struct minifs_dirent), shell_ls_cmp_mtime);
+    for (i = 0; i < list.count; ++i)
+        shell_ls_print(list.entries + i);
+
+    free(list.entries);
+    return status;
+}
+
+void shell_report(void* arg, const char* path, int error)
+{
+    printf("%s: %s: %s\n", (const char*)arg, path, minifs_strerror(error));
+}
+
+void shell_tree_print(const char* cmd, struct minifs_tree_stats* st)
+{
+    double sec = st->ns / 1e9;
+    if (sec <= 0)
+        sec = 1e-9;
+
+    printf("%s: %u directories, %u files, %.1f MiB in %.3f s: %.0f files/s, %.1f MiB/s",
+           cmd, st->ndirs, st->nfiles, st->bytes / 1048576.0, sec, st->nfiles / sec, st->bytes / 1048576.0 / sec);
+    if (st->failed + st->skipped)
+        printf("; %u failed, %u skipped", st->failed, st->skipped);
+    puts("");
+}
+
+// Runs one command, argv[0] being its name and missing arguments empty
+// strings, and sets *failed if it reports an error. Returns 0 once the
+// shell has to stop.
+int run_command(struct minifs* fs, char* cwd, char** argv, int* failed)
+{
+    char* cmd = argv[0];
+    int recursive = strcmp(argv[1], "-r") == 0;
+    char** args = argv + recursive;
+
+    char path[SHELL_PATH];
+    struct minifs_stat st;
+    struct minifs_tree_stats ts;
+    int status;
 
-        strncpy(arg1, cmd + j + 1, i - j);
-        strncpy(arg2, cmd + i + 1, len - i);
+    ts.report = shell_report;
+    ts.arg = cmd;
 
-        arg1[i - j - 1] = 0;
-        arg2[len - i - 2] = 0;
-        cmd[j] = 0;
+    if (strcmp(cmd, "exit") == 0)
+        return 0;
 
-        if (strncmp(cmd, "ls", len) == 0)
-            fs_ls(sb, fd, root);
-        else if (strncmp(cmd, "mkdir", len) == 0)
-            fs_mkdir(sb, fd, root, arg1);
-        else if (strncmp(cmd, "cd", len) == 0)
+    if (strcmp(cmd, "ls") == 0)
+    {
+        int by_time = strcmp(argv[1], "-t") == 0;
+        status = shell_join(path, cwd, argv[1 + by_time]) ? shell_ls(fs, path, by_time) : -ENAMETOOLONG;
+        if (status != 0)
         {
-            int found = fs_cd(sb, fd, root, arg1);
-
-            if (!found)
-                continue;
-
-            if (strncmp(arg1, "..", 2) == 0)
-            {
-                len = strlen(path) - 2;
-                if (len != -1)
-                {
-                    path[len + 1] = 0;
-                    for (; path[len] != '/'; --len)
-                        path[len] = 0;
-                }
-            }
-            else
-            {
-                strncpy(path + strlen(path), root->name, 32);
-                len = strlen(path);
-                path[len] = '/';
-                path[len + 1] = 0;
-            }
+            printf("ls: %s: %s\n", argv[1 + by_time], minifs_strerror(status));
+            *failed = 1;
         }
-        else if (strncmp(cmd, "rm", len) == 0)
-            fs_rm(sb, fd, root, arg1);
-        else if (strncmp(cmd, "pull", len) == 0)
-            fs_pull(sb, fd, root, arg1, arg2);
-        else if (strncmp(cmd, "push", len) == 0)
-            fs_push(sb, fd, root, arg1, arg2);
+    }
+    else if (strcmp(cmd, "mkdir") == 0)
+    {
+        *failed = 1;
+        if (strlen(argv[1]) == 0)
+            puts("mkdir: empty directory name");
+        else if (!shell_join(path, cwd, argv[1]))
+            puts("mkdir: path too long");
+        else if ((status = minifs_mkdir(fs, path)) != 0)
+            printf("mkdir: cannot create directory: %s\n", minifs_strerror(status));
         else
-            puts("unknown command");
+            *failed = 0;
     }
+    else if (strcmp(cmd, "cd") == 0)
+    {
+        *failed = 1;
+        if (strlen(argv[1]) == 0)
+            puts("cd: empty directory name");
+        else if (!shell_join(path, cwd, argv[1]) || minifs_stat(fs, path, &st) != 0 || st.type != 'd')
+            printf("cd: %s: no such directory\n", argv[1]);
+        else
+        {
+            strcpy(cwd, path);
+            *failed = 0;
+        }
+    }
+    else if (strcmp(cmd, "rm") == 0)
+    {
+        *failed = 1;
+        if (strlen(argv[1]) == 0)
+            puts("rm: empty object name");
+        else if (!shell_join(path, cwd, argv[1]))
+            puts("rm: path too long");
+        else if ((status = minifs_remove(fs, path)) != 0)
+            printf("rm: %s: %s\n", argv[1], minifs_strerror(status));
+        else
+            *failed = 0;
+    }
+    else if (strcmp(cmd, "pull") == 0 || strcmp(cmd, "push") == 0)
+    {
+        int pull = strcmp(cmd, "pull") == 0;
+        *failed = 1;
+        if (strlen(args[1]) == 0 || strlen(args[2]) == 0)
+            printf("%s: empty file name(s)\n", cmd);
+        else if (!shell_join(path, cwd, pull ? args[2] : args[1]))
+            printf("%s: path too long\n", cmd);
+        else
+        {
+            if (pull && recursive)
+                status = minifs_import_tree(fs, args[1], path, &ts);
+            else if (pull)
+                status = minifs_import(fs, args[1], path);
+            else if (recursive)
+                status = minifs_export_tree(fs, path, args[2], &ts);
+            else
+                status = minifs_export(fs, path, args[2]);
+
+            if (status != 0)
+                printf("%s: cannot %s %s: %s\n", cmd, cmd, args[1], minifs_strerror(status));
+            else if (recursive)
+                shell_tree_print(cmd, &ts);
+
+            // a tree copy that lost objects on the way has failed as well
+            *failed = status != 0 || (recursive && ts.failed != 0);
+        }
+    }
+    else if (strcmp(cmd, "sync") == 0)
+    {
+        struct minifs_statfs sfs;
+        if ((status = minifs_sync(fs)) != 0)
+        {
+            printf("sync: %s\n", minifs_strerror(status));
+            *failed = 1;
+        }
+        minifs_statfs(fs, &sfs);
+        if (sfs.io != MINIFS_MMAP)
+            printf("cache: %llu hits, %llu misses\n", (unsigned long long)sfs.cache_hits, (unsigned long long)sfs.cache_misses);
+        printf("dentries: %llu hits, %llu misses\n", (unsigned long long)sfs.dentry_hits, (unsigned long long)sfs.dentry_misses);
+    }
+    else
+    {
+        puts("unknown command");
+        *failed = 1;
+    }
+
+    return 1;
 }
 
-int main()
+// Reads commands from in until exit or end of input. Interactive sessions
+// get the banner and a prompt; a batch runs silently and reports the time
+// every command took on stderr. Returns the number of commands that failed.
+uint32_t run_shell(struct minifs* fs, FILE* in, int batch)
 {
-    int fd = open("fs", O_RDWR);
-    if (fd == -1)
+    char cwd[SHELL_PATH] = "/";
+    char* line = NULL;
+    size_t size = 0;
+
+    char empty[1] = "";
+    char* argv[SHELL_ARGS];
+    uint32_t i, ncommands = 0, nfailed = 0;
+    uint64_t total = 0;
+    struct timespec t0, t1;
+
+    if (!batch)
+        print_help();
+
+    for (;;)
     {
-        perror("cannot open fs.img file");
+        if (!batch)
+        {
+            printf("%s$ ", cwd);
+            fflush(stdout);
+        }
+
+        if (getline(&line, &size, in) == -1)
+            break;
+
+        char* save;
+        char* token = strtok_r(line, " \t\r\n", &save);
+        if (token == NULL || token[0] == '#')
+            continue;
+
+        argv[0] = token;
+        for (i = 1; i < SHELL_ARGS; ++i)
+        {
+            argv[i] = strtok_r(NULL, " \t\r\n", &save);
+            if (argv[i] == NULL)
+                argv[i] = empty;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        int failed = 0;
+        int more = run_command(fs, cwd, argv, &failed);
+        nfailed += failed;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        uint64_t elapsed = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+
+        if (batch)
+        {
+            fflush(stdout);
+            fprintf(stderr, "%10.3f ms  %s", elapsed / 1e6, argv[0]);
+            for (i = 1; i < SHELL_ARGS && argv[i][0]; ++i)
+                fprintf(stderr, " %s", argv[i]);
+            fputc('\n', stderr);
+
+            total += elapsed;
+            ++ncommands;
+        }
+
+        if (!more)
+            break;
+    }
+
+    if (batch && ncommands)
+        fprintf(stderr, "%u commands in %.3f ms, %.3f ms each on average\n", ncommands, total / 1e6, total / 1e6 / ncommands);
+
+    free(line);
+    return nfailed;
+}
+
+int main(int argc, char** argv)
+{
+    int flags = 0;
+    const char* script = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "muf:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            flags |= MINIFS_MMAP;
+            break;
+        case 'u':
+            flags |= MINIFS_URING;
+            break;
+        case 'f':
+            script = optarg;
+            break;
+        default:
+            puts("usage: fs_run [-m | -u] [-f script] [image]\n\
+         \t-m: access the image through mmap instead of pread/pwrite\n\
+         \t-u: batch block I/O on an io_uring (pread/pwrite if unavailable)\n\
+         \t-f: run the commands in script (- for stdin) without prompts, timing each one\n\
+         exits with 1 if any command failed, a recursive copy that lost objects included");
+            return 1;
+        }
+    }
+
+    FILE* in = stdin;
+    if (script && strcmp(script, "-") != 0 && (in = fopen(script, "r")) == NULL)
+    {
+        perror("cannot open script");
         return 1;
     }
 
-    struct s_superblock* sb;
-    superblock_init(&sb, 0, 0, 0, 0, 0, 0, 0);
-    superblock_read(sb, fd);
+    // a batch leaves metadata in the cache until it is done (or says sync)
+    if (script)
+        flags |= MINIFS_BATCH;
 
-    struct s_inode* root;
-    inode_init(&root, 0, 0, "", 0);
-    inode_read(root, sb, fd, sb->root_block * sb->block_size);
+    const char* image = optind < argc ? argv[optind] : "fs";
+    struct minifs* fs;
+    int status = minifs_mount(image, flags, &fs);
+    if (status != 0)
+    {
+        printf("cannot mount %s: %s\n", image, minifs_strerror(status));
+        if (in != stdin)
+            fclose(in);
+        return 1;
+    }
 
-    run_shell(sb, fd, root);
+    struct minifs_statfs st;
+    minifs_statfs(fs, &st);
+    if ((flags & MINIFS_URING) && st.io != MINIFS_URING)
+        puts("io_uring is not available, using pread/pwrite");
 
-    pwrite(fd, sb, sizeof(struct s_superblock), 0);
+    uint32_t nfailed = run_shell(fs, in, script != NULL);
 
-    superblock_del(sb);
-    inode_del(root);
-    close(fd);
+    status = minifs_unmount(fs);
+    if (status != 0)
+        printf("cannot unmount %s: %s\n", image, minifs_strerror(status));
+    if (in != stdin)
+        fclose(in);
 
-    return 0;
+    return status != 0 || nfailed != 0;
 }
@@ -0,0 +1,162 @@
+#include "inode.h"
+
+void inode_init(struct s_inode** node,
+                uint32_t ninode,
+                uint32_t parent_inode,
+                const char* name,
+                char type)
+{
+    (*node) = (struct s_inode*)malloc(sizeof(struct s_inode));
+
+    memset((*node)->blocks, 0, 12 * sizeof(uint32_t));
+
+    (*node)->iblock = 0;
+    (*node)->diblock = 0;
+    (*node)->tiblock = 0;
+    (*node)->nblocks = 0;
+
+    (*node)->ninode = ninode;
+    (*node)->parent_inode = parent_inode;
+
+    strncpy((*node)->name, name, NAME_LEN - 1);
+    (*node)->name[NAME_LEN - 1] = 0;
+
+    (*node)->size = INODE_SIZE;
+
+    (*node)->ctime = get_time_ns();
+    (*node)->mtime = (*node)->ctime;
+    (*node)->atime = (*node)->ctime;
+
+    (*node)->type = type;
+}
+
+void inode_del(struct s_inode* node)
+{
+    free(node);
+}
+
+void inode_copy(struct s_inode* node, struct s_inode* other)
+{
+    memcpy(node->blocks, other->blocks, 12 * sizeof(uint32_t));
+    node->iblock = other->iblock;
+    node->diblock = other->diblock;
+    node->tiblock = other->tiblock;
+    node->nblocks = other->nblocks;
+
+    node->ninode = other->ninode;
+    node->parent_inode = other->parent_inode;
+
+    strncpy(node->name, other->name, NAME_LEN);
+
+    node->ctime = other->ctime;
+    node->mtime = other->mtime;
+    node->atime = other->atime;
+
+    node->size = other->size;
+
+    node->type = other->type;
+}
+
+void inode_put32(uint8_t* buf, uint32_t value)
+{
+    value = htole32(value);
+    memcpy(buf, &value, sizeof(uint32_t));
+}
+
+void inode_put64(uint8_t* buf, uint64_t value)
+{
+    value = htole64(value);
+    memcpy(buf, &value, sizeof(uint64_t));
+}
+
+uint32_t inode_get32(const uint8_t* buf)
+{
+    uint32_t value;
+    memcpy(&value, buf, sizeof(uint32_t));
+    return le32toh(value);
+}
+
+uint64_t inode_get64(const uint8_t* buf)
+{
+    uint64_t value;
+    memcpy(&value, buf, sizeof(uint64_t));
+    return le64toh(value);
+}
+
+void inode_encode(struct s_inode* node, uint8_t* buf)
+{
+    uint32_t i;
+    for (i = 0; i < 12; ++i)
+        inode_put32(buf + i * sizeof(uint32_t), node->blocks[i]);
+
+    inode_put32(buf + 48, node->iblock);
+    inode_put32(buf + 52, node->diblock);
+    inode_put32(buf + 56, node->tiblock);
+    inode_put32(buf + 60, node->nblocks);
+    inode_put32(buf + 64, node->parent_inode);
+    inode_put32(buf + 68, node->size);
+    inode_put64(buf + 72, node->ctime);
+    inode_put64(buf + 80, node->mtime);
+    inode_put64(buf + 88, node->atime);
+    memcpy(buf + 96, node->name, NAME_LEN * sizeof(char));
+    memcpy(buf + 127, &node->type, sizeof(char));
+}
+
+void inode_decode(struct s_inode* node, const uint8_t* buf)
+{
+    uint32_t i;
+    for (i = 0; i < 12; ++i)
+        node->blocks[i] = inode_get32(buf + i * sizeof(uint32_t));
+
+    node->iblock = inode_get32(buf + 48);
+    node->diblock = inode_get32(buf + 52);
+    node->tiblock = inode_get32(buf + 56);
+    node->nblocks = inode_get32(buf + 60);
+    node->parent_inode = inode_get32(buf + 64);
+    node->size = inode_get32(buf + 68);
+    node->ctime = inode_get64(buf + 72);
+    node->mtime = inode_get64(buf + 80);
+    node->atime = inode_get64(buf + 88);
+    memcpy(node->name, buf + 96, NAME_LEN * sizeof(char));
+    memcpy(&node->type, buf + 127, sizeof(char));
+
+    node->name[NAME_LEN - 1] = 0;
+}
+
+uint64_t inode_get_offset(struct s_superblock* sb, uint32_t ninode)
+{
+    return get_block_offset(sb, sb->inode_table) + (uint64_t)ninode * INODE_SIZE;
+}
+
+void inode_read(struct s_inode* node, struct s_superblock* sb, int fd, uint32_t ninode)
+{
+    uint64_t offset = inode_get_offset(sb, ninode);
+    uint8_t buf[INODE_SIZE];
+    uint8_t* ptr = (sb->cache == NULL ? io_get_ptr(sb, offset) : NULL);
+
+    if (ptr == NULL)
+    {
+        cache_pread(sb, fd, buf, INODE_SIZE, offset);
+        ptr = buf;
+    }
+
+    inode_decode(node, ptr);
+
+    node->ninode = ninode;
+}
+
+void inode_write(struct s_inode* node, struct s_superblock* sb, int fd, uint32_t ninode)
+{
+    uint64_t offset = inode_get_offset(sb, ninode);
+    uint8_t* ptr = (sb->cache == NULL ? io_get_ptr(sb, offset) : NULL);
+    if (ptr)
+    {
+        inode_encode(node, ptr);
+        return;
+    }
+
+    uint8_t buf[INODE_SIZE];
+
+    inode_encode(node, buf);
+    cache_pwrite(sb, fd, buf, INODE_SIZE, offset);
+}
@@ -2,27 +2,42 @@
 #define INODE_H_INCLUDED
 
 #include <stdlib.h>
-#include <time.h>
 #include <string.h>
+#include <endian.h>
 #include "superblock.h"
 #include "bitmap.h"
 #include "utils.h"
+#include "cache.h"
+#include "io.h"
 
 #define NAME_LEN 31
-#define TIME_LEN 25
+
+// On-disk inode layout (revision 7), packed little-endian without padding.
+// The inode number is not stored, it is the inode's index in the inode table.
+// Times are nanoseconds since the epoch.
+//
+//     0  blocks[12]     48  iblock     52  diblock    56  tiblock
+//    60  nblocks        64  parent_inode              68  size
+//    72  ctime          80  mtime      88  atime      96  name[31]
+//   127  type
+#define INODE_SIZE 128
 
 struct s_inode
 {
     uint32_t blocks[12];
     uint32_t iblock;
-    uint32_t nlast;
+    uint32_t diblock;
+    uint32_t tiblock;
+    uint32_t nblocks;
 
     uint32_t ninode;
     uint32_t parent_inode;
 
     char name[NAME_LEN];
 
-    char crtime[TIME_LEN];
+    uint64_t ctime;
+    uint64_t mtime;
+    uint64_t atime;
 
     uint32_t size;
 
@@ -33,109 +48,29 @@ void inode_init(struct s_inode** node,
                 uint32_t ninode,
                 uint32_t parent_inode,
                 const char* name,
-                char type)
-{
-    (*node) = (struct s_inode*)malloc(sizeof(struct s_inode));
-
-    memset((*node)->blocks, 0, 12 * sizeof(uint32_t));
-
-    (*node)->iblock = 0;
-    (*node)->nlast = 0;
-
-    (*node)->ninode = ninode;
-    (*node)->parent_inode = parent_inode;
-
-    strncpy((*node)->name, name, NAME_LEN - 1);
-
-    (*node)->size = sizeof(struct s_inode);
-
-    time_t rawtime;
-    time(&rawtime);
-    struct tm* timeinfo = localtime(&rawtime);
-    strncpy((*node)->crtime, asctime(timeinfo), TIME_LEN - 1);
-
-    (*node)->type = type;
-}
-
-void inode_del(struct s_inode* node)
-{
-    free(node);
-}
-
-void inode_copy(struct s_inode* node, struct s_inode* other)
-{
-    memcpy(node->blocks, other->blocks, 12 * sizeof(uint32_t));
-    node->iblock = other->iblock;
-    node->nlast = other->nlast;
-
-    node->ninode = other->ninode;
-    node->parent_inode = other->parent_inode;
+                char type);
 
-    strncpy(node->name, other->name, NAME_LEN);
+void inode_del(struct s_inode* node);
 
-    strncpy(node->crtime, other->crtime, TIME_LEN);
+void inode_copy(struct s_inode* node, struct s_inode* other);
 
-    node->size = other->size;
-
-    node->type = other->type;
-}
-
-void inode_read(struct s_inode* node, struct s_superblock* sb, int fd, uint32_t offset)
-{
-    pread(fd, node->blocks, 12 * sizeof(uint32_t), offset);
-    offset += 12 * sizeof(uint32_t);
-
-    pread(fd, &node->iblock, sizeof(uint32_t), offset);
-    offset += sizeof(uint32_t);
-
-    pread(fd, &node->nlast, sizeof(uint32_t), offset);
-    offset += sizeof(uint32_t);
-
-    pread(fd, &node->ninode, sizeof(uint32_t), offset);
-    offset += sizeof(uint32_t);
-
-    pread(fd, &node->parent_inode, sizeof(uint32_t), offset);
-    offset += sizeof(uint32_t);
-
-    pread(fd, node->name, NAME_LEN * sizeof(char), offset);
-    offset += NAME_LEN * sizeof(char);
-
-    pread(fd, node->crtime, TIME_LEN * sizeof(char), offset);
-    offset += TIME_LEN * sizeof(char);
-
-    pread(fd, &node->size, sizeof(uint32_t), offset);
-    offset += sizeof(uint32_t);
-
-    pread(fd, &node->type, sizeof(char), offset);
-}
-
-void inode_write(struct s_inode* node, struct s_superblock* sb, int fd, uint32_t offset)
-{
-    pwrite(fd, node->blocks, 12 * sizeof(uint32_t), offset);
-    offset += 12 * sizeof(uint32_t);
+// Fields are stored through these, little-endian whatever the host.
+void inode_put32(uint8_t* buf, uint32_t value);
 
-    pwrite(fd, &node->iblock, sizeof(uint32_t), offset);
-    offset += sizeof(uint32_t);
+void inode_put64(uint8_t* buf, uint64_t value);
 
-    pwrite(fd, &node->nlast, sizeof(uint32_t), offset);
-    offset += sizeof(uint32_t);
+uint32_t inode_get32(const uint8_t* buf);
 
-    pwrite(fd, &node->ninode, sizeof(uint32_t), offset);
-    offset += sizeof(uint32_t);
+uint64_t inode_get64(const uint8_t* buf);
 
-    pwrite(fd, &node->parent_inode, sizeof(uint32_t), offset);
-    offset += sizeof(uint32_t);
+void inode_encode(struct s_inode* node, uint8_t* buf);
 
-    pwrite(fd, node->name, NAME_LEN * sizeof(char), offset);
-    offset += NAME_LEN * sizeof(char);
+void inode_decode(struct s_inode* node, const uint8_t* buf);
 
-    pwrite(fd, node->crtime, TIME_LEN * sizeof(char), offset);
-    offset += TIME_LEN * sizeof(char);
+uint64_t inode_get_offset(struct s_superblock* sb, uint32_t ninode);
 
-    pwrite(fd, &node->size, sizeof(uint32_t), offset);
-    offset += sizeof(uint32_t);
+void inode_read(struct s_inode* node, struct s_superblock* sb, int fd, uint32_t ninode);
 
-    pwrite(fd, &node->type, sizeof(char), offset);
-}
+void inode_write(struct s_inode* node, struct s_superblock* sb, int fd, uint32_t ninode);
 
 #endif // INODE_H_INCLUDED
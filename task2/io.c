@@ -0,0 +1,369 @@
+#include "io.h"
+
+int io_open(struct s_superblock* sb, int fd, int type)
+{
+    struct s_io* io = (struct s_io*)malloc(sizeof(struct s_io));
+
+    io->type = type;
+    io->map = NULL;
+    io->size = get_block_offset(sb, sb->blocks_total);
+    io->ring = NULL;
+
+    // no io_uring in this kernel (or it is disabled): stay synchronous
+    if (type == IO_URING && !uring_init(&io->ring, URING_ENTRIES))
+        io->type = IO_PREAD;
+
+    if (type == IO_MMAP)
+    {
+        void* map = mmap(NULL, io->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            free(io);
+            return 0;
+        }
+
+        io->map = (uint8_t*)map;
+    }
+
+    sb->io = io;
+    return 1;
+}
+
+void io_close(struct s_superblock* sb)
+{
+    if (sb->io == NULL)
+        return;
+
+    if (sb->io->map)
+        munmap(sb->io->map, sb->io->size);
+    if (sb->io->ring)
+        uring_del(sb->io->ring);
+
+    free(sb->io);
+    sb->io = NULL;
+}
+
+uint8_t* io_get_ptr(struct s_superblock* sb, uint64_t offset)
+{
+    if (sb->io == NULL || sb->io->map == NULL)
+        return NULL;
+
+    return sb->io->map + offset;
+}
+
+ssize_t io_pread(struct s_superblock* sb, int fd, void* buf, size_t len, uint64_t offset)
+{
+    uint8_t* ptr = io_get_ptr(sb, offset);
+    if (ptr == NULL)
+        return pread(fd, buf, len, offset);
+
+    if (offset >= sb->io->size)
+        return 0;
+    if (len > sb->io->size - offset)
+        len = sb->io->size - offset;
+
+    memcpy(buf, ptr, len);
+    return len;
+}
+
+ssize_t io_pwrite(struct s_superblock* sb, int fd, const void* buf, size_t len, uint64_t offset)
+{
+    uint8_t* ptr = io_get_ptr(sb, offset);
+    if (ptr == NULL)
+        return pwrite(fd, buf, len, offset);
+
+    if (offset >= sb->io->size)
+        return 0;
+    if (len > sb->io->size - offset)
+        len = sb->io->size - offset;
+
+    memcpy(ptr, buf, len);
+    return len;
+}
+
+int io_queue_pread(struct s_superblock* sb, int fd, void* buf, uint32_t len, uint64_t offset)
+{
+    if (sb->io && sb->io->ring)
+        return uring_queue(sb->io->ring, IORING_OP_READ, fd, buf, len, offset);
+
+    return io_pread(sb, fd, buf, len, offset) == (ssize_t)len;
+}
+
+int io_queue_pwrite(struct s_superblock* sb, int fd, const void* buf, uint32_t len, uint64_t offset)
+{
+    if (sb->io && sb->io->ring)
+        return uring_queue(sb->io->ring, IORING_OP_WRITE, fd, (void*)buf, len, offset);
+
+    return io_pwrite(sb, fd, buf, len, offset) == (ssize_t)len;
+}
+
+int io_wait(struct s_superblock* sb)
+{
+    if (sb->io && sb->io->ring)
+        return uring_wait(sb->io->ring);
+
+    return 1;
+}
+
+int64_t io_read_full(int hfd, uint8_t* buf, uint64_t len)
+{
+    uint64_t done = 0;
+    ssize_t n;
+    for (; done < len; done += n)
+    {
+        if ((n = read(hfd, buf + done, len - done)) == -1)
+            return -1;
+        if (n == 0)
+            break;
+    }
+
+    return done;
+}
+
+int io_write_full(int hfd, const uint8_t* buf, uint64_t len)
+{
+    ssize_t n;
+    for (; len; len -= n, buf += n)
+        if ((n = write(hfd, buf, len)) <= 0)
+            return 0;
+
+    return 1;
+}
+
+int io_copy_from(struct s_superblock* sb, int fd, int hfd, uint64_t len, uint64_t offset)
+{
+    uint8_t* ptr = io_get_ptr(sb, offset);
+    if (ptr)
+        return io_read_full(hfd, ptr, len) != -1;
+
+    ssize_t n = 0;
+    while (len)
+    {
+        loff_t off = offset;
+        if ((n = syscall(SYS_copy_file_range, hfd, NULL, fd, &off, len, 0)) <= 0)
+            break;
+
+        offset += n;
+        len -= n;
+    }
+
+    if (len == 0)
+        return 1;
+
+    // copy_file_range also reads 0 from files whose size is made up, such
+    // as those in /proc and /sys, so read() has the last word on the end
+    uint8_t* buf = (uint8_t*)malloc(IO_SIZE);
+    while (len)
+    {
+        n = read(hfd, buf, len < IO_SIZE ? len : IO_SIZE);
+        if (n > 0 && pwrite(fd, buf, n, offset) != n)
+            n = -1;
+        if (n <= 0)
+            break;
+
+        offset += n;
+        len -= n;
+    }
+
+    free(buf);
+    return n != -1;
+}
+
+int io_copy_to(struct s_superblock* sb, int fd, int hfd, uint64_t len, uint64_t offset)
+{
+    uint8_t* ptr = io_get_ptr(sb, offset);
+    if (ptr)
+        return io_write_full(hfd, ptr, len);
+
+    ssize_t n = 0;
+    while (len)
+    {
+        off_t off = offset;
+        if ((n = sendfile(hfd, fd, &off, len)) <= 0)
+            break;
+
+        offset += n;
+        len -= n;
+    }
+
+    if (len == 0 || n == 0)
+        return len == 0;
+
+    uint8_t* buf = (uint8_t*)malloc(IO_SIZE);
+    while (len)
+    {
+        n = pread(fd, buf, len < IO_SIZE ? len : IO_SIZE, offset);
+        if (n <= 0 || !io_write_full(hfd, buf, n))
+            break;
+
+        offset += n;
+        len -= n;
+    }
+
+    free(buf);
+    return len == 0;
+}
+
+int io_readv_full(int hfd, struct iovec* iov, int cnt)
+{
+    ssize_t n;
+    while (cnt)
+    {
+        if ((n = readv(hfd, iov, cnt)) <= 0)
+            return n == 0;
+
+        for (; cnt && (size_t)n >= iov->iov_len; --cnt, ++iov)
+            n -= iov->iov_len;
+        if (cnt)
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 1;
+}
+
+int io_writev_full(int hfd, struct iovec* iov, int cnt)
+{
+    ssize_t n;
+    while (cnt)
+    {
+        if ((n = writev(hfd, iov, cnt)) <= 0)
+            return 0;
+
+        for (; cnt && (size_t)n >= iov->iov_len; --cnt, ++iov)
+            n -= iov->iov_len;
+        if (cnt)
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 1;
+}
+
+void io_batch_init(struct s_io_batch* batch, struct s_superblock* sb)
+{
+    batch->cnt = 0;
+    batch->used = 0;
+    batch->buf = sb->io && sb->io->map ? NULL : (uint8_t*)malloc(IO_BATCH);
+}
+
+int io_batch_flush(struct s_io_batch* batch, struct s_superblock* sb, int fd, int hfd, int from)
+{
+    int i, cnt = batch->cnt, ok = 1;
+
+    if (batch->buf && !from)
+    {
+        for (i = 0; i < cnt && ok; ++i)
+            ok = io_queue_pread(sb, fd, batch->iov[i].iov_base, batch->iov[i].iov_len, batch->offset[i]);
+        ok = io_wait(sb) && ok;
+    }
+
+    if (ok && from)
+    {
+        struct iovec iov[IO_IOV];
+        memcpy(iov, batch->iov, cnt * sizeof(struct iovec));
+        ok = io_readv_full(hfd, iov, cnt);
+    }
+    else if (ok)
+        ok = io_writev_full(hfd, batch->iov, cnt);
+
+    if (batch->buf && from)
+    {
+        for (i = 0; i < cnt && ok; ++i)
+            ok = io_queue_pwrite(sb, fd, batch->iov[i].iov_base, batch->iov[i].iov_len, batch->offset[i]);
+        ok = io_wait(sb) && ok;
+    }
+
+    batch->cnt = 0;
+    batch->used = 0;
+    return ok;
+}
+
+int io_blocks_move(struct s_superblock* sb, int fd, int hfd, const uint32_t* blocks, uint32_t n, uint64_t len, int from)
+{
+    struct s_io_batch batch;
+    io_batch_init(&batch, sb);
+
+    uint32_t i, j;
+    uint64_t run, offset;
+    int ok = 1;
+
+    for (i = 0; i < n && len && ok; i = j)
+    {
+        for (j = i + 1; j < n && blocks[j] == blocks[j - 1] + 1; ++j);
+
+        run = (uint64_t)(j - i) * sb->block_size;
+        if (run > len)
+            run = len;
+        len -= run;
+        offset = get_block_offset(sb, blocks[i]);
+
+        if (batch.buf && run >= IO_SIZE)
+        {
+            if (batch.cnt)
+                ok = io_batch_flush(&batch, sb, fd, hfd, from);
+            if (ok)
+                ok = from ? io_copy_from(sb, fd, hfd, run, offset) : io_copy_to(sb, fd, hfd, run, offset);
+            continue;
+        }
+
+        if (batch.cnt == IO_IOV || (batch.buf && batch.used + run > IO_BATCH))
+            if (!(ok = io_batch_flush(&batch, sb, fd, hfd, from)))
+                break;
+
+        batch.iov[batch.cnt].iov_base = batch.buf ? batch.buf + batch.used : io_get_ptr(sb, offset);
+        batch.iov[batch.cnt].iov_len = run;
+        batch.offset[batch.cnt++] = offset;
+        batch.used += run;
+    }
+
+    if (ok && batch.cnt)
+        ok = io_batch_flush(&batch, sb, fd, hfd, from);
+
+    free(batch.buf);
+    return ok;
+}
+
+int io_blocks_from(struct s_superblock* sb, int fd, int hfd, const uint32_t* blocks, uint32_t n, uint64_t len)
+{
+    return io_blocks_move(sb, fd, hfd, blocks, n, len, 1);
+}
+
+int io_blocks_to(struct s_superblock* sb, int fd, int hfd, const uint32_t* blocks, uint32_t n, uint64_t len)
+{
+    return io_blocks_move(sb, fd, hfd, blocks, n, len, 0);
+}
+
+int io_blocks_write(struct s_superblock* sb, int fd, const uint8_t* buf, const uint32_t* blocks, uint32_t n, uint64_t len)
+{
+    uint32_t i, j;
+    uint64_t run;
+    int ok = 1;
+
+    for (i = 0; i < n && len && ok; i = j)
+    {
+        for (j = i + 1; j < n && blocks[j] == blocks[j - 1] + 1 && (uint64_t)(j - i) * sb->block_size < IO_BATCH; ++j);
+
+        run = (uint64_t)(j - i) * sb->block_size;
+        if (run > len)
+            run = len;
+
+        ok = io_queue_pwrite(sb, fd, buf, run, get_block_offset(sb, blocks[i]));
+        buf += run;
+        len -= run;
+    }
+
+    return io_wait(sb) && ok;
+}
+
+int io_sync(struct s_superblock* sb, int fd)
+{
+    if (sb->io && sb->io->map)
+        return msync(sb->io->map, sb->io->size, MS_SYNC) == 0;
+
+    return fdatasync(fd) == 0;
+}
@@ -0,0 +1,116 @@
+#ifndef IO_H_INCLUDED
+#define IO_H_INCLUDED
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "superblock.h"
+#include "utils.h"
+#include "uring.h"
+
+#define IO_PREAD 0
+#define IO_MMAP 1
+#define IO_URING 2
+
+#define IO_SIZE 65536
+#define IO_BATCH 1048576
+#define IO_IOV 256
+
+// Backend every image access goes through. IO_PREAD issues pread/pwrite on
+// the image fd; IO_MMAP maps the whole image and copies to and from the
+// mapping, and io_get_ptr hands out pointers straight into it. IO_URING
+// behaves like IO_PREAD for single requests, but io_queue_* requests are
+// batched on an io_uring and only complete at io_wait.
+struct s_io
+{
+    int type;
+
+    uint8_t* map;
+    uint64_t size;
+
+    struct s_uring* ring;
+};
+
+int io_open(struct s_superblock* sb, int fd, int type);
+
+void io_close(struct s_superblock* sb);
+
+// Direct pointer to offset inside the mapped image, NULL for other backends.
+uint8_t* io_get_ptr(struct s_superblock* sb, uint64_t offset);
+
+ssize_t io_pread(struct s_superblock* sb, int fd, void* buf, size_t len, uint64_t offset);
+
+ssize_t io_pwrite(struct s_superblock* sb, int fd, const void* buf, size_t len, uint64_t offset);
+
+// Queued requests: buf has to stay untouched until io_wait. Without a ring
+// they are carried out on the spot.
+int io_queue_pread(struct s_superblock* sb, int fd, void* buf, uint32_t len, uint64_t offset);
+
+int io_queue_pwrite(struct s_superblock* sb, int fd, const void* buf, uint32_t len, uint64_t offset);
+
+int io_wait(struct s_superblock* sb);
+
+// Reads until len bytes or the end of the file, returns how many it read,
+// -1 on error.
+int64_t io_read_full(int hfd, uint8_t* buf, uint64_t len);
+
+int io_write_full(int hfd, const uint8_t* buf, uint64_t len);
+
+// Moves len bytes from the current position of the host file hfd into the
+// image at offset, fewer if the file ends first; returns 0 on error. The
+// data is copied inside the kernel (copy_file_range, or a read straight into
+// the mapping) whenever possible, and through an IO_SIZE buffer otherwise,
+// e.g. when hfd is a pipe.
+int io_copy_from(struct s_superblock* sb, int fd, int hfd, uint64_t len, uint64_t offset);
+
+// Mirror of io_copy_from: appends len bytes of the image at offset to hfd,
+// with sendfile (or a write straight from the mapping) where possible.
+int io_copy_to(struct s_superblock* sb, int fd, int hfd, uint64_t len, uint64_t offset);
+
+// readv/writev until all of iov[0..cnt) is transferred, or readv reaches the
+// end of the file; iov is consumed.
+int io_readv_full(int hfd, struct iovec* iov, int cnt);
+
+int io_writev_full(int hfd, struct iovec* iov, int cnt);
+
+// Block-list I/O: moves the first len bytes of blocks[0..n) between the
+// image and the host stream hfd, in list order. Adjacent blocks merge into
+// one run. Runs of IO_SIZE and more are copied on their own with
+// io_copy_from/io_copy_to; shorter ones are gathered into an iovec batch
+// so the host side takes a single readv/writev per IO_IOV runs. In mmap
+// mode the iovecs point straight into the mapping, otherwise into an
+// IO_BATCH staging buffer filled or drained with one pread/pwrite per run.
+struct s_io_batch
+{
+    struct iovec iov[IO_IOV];
+    uint64_t offset[IO_IOV];
+    int cnt;
+
+    uint8_t* buf;
+    uint64_t used;
+};
+
+void io_batch_init(struct s_io_batch* batch, struct s_superblock* sb);
+
+int io_batch_flush(struct s_io_batch* batch, struct s_superblock* sb, int fd, int hfd, int from);
+
+int io_blocks_move(struct s_superblock* sb, int fd, int hfd, const uint32_t* blocks, uint32_t n, uint64_t len, int from);
+
+// Stops early, and still succeeds, at the end of hfd; the file position of
+// hfd tells how much it read.
+int io_blocks_from(struct s_superblock* sb, int fd, int hfd, const uint32_t* blocks, uint32_t n, uint64_t len);
+
+int io_blocks_to(struct s_superblock* sb, int fd, int hfd, const uint32_t* blocks, uint32_t n, uint64_t len);
+
+// Writes the first len bytes of buf to blocks[0..n), one request per run.
+int io_blocks_write(struct s_superblock* sb, int fd, const uint8_t* buf, const uint32_t* blocks, uint32_t n, uint64_t len);
+
+// Makes every write so far durable; returns 0 if it could not.
+int io_sync(struct s_superblock* sb, int fd);
+
+#endif // IO_H_INCLUDED
@@ -0,0 +1,255 @@
+#include "journal.h"
+
+uint32_t journal_get_head_blocks(struct s_superblock* sb, uint32_t n)
+{
+    return (JOURNAL_HEAD + n * sizeof(uint32_t) + sb->block_size - 1) / sb->block_size;
+}
+
+uint64_t journal_get_offset(struct s_superblock* sb, uint64_t seq)
+{
+    return get_block_offset(sb, sb->journal_block + (seq & 1) * (sb->journal_len / 2));
+}
+
+uint64_t journal_checksum(uint64_t hash, const uint8_t* buf, uint64_t len)
+{
+    for (; len; --len)
+        hash = (hash ^ *buf++) * 1099511628211ULL;
+
+    return hash;
+}
+
+uint8_t* journal_read(struct s_superblock* sb, int fd, uint64_t half, uint32_t* nblocks, uint64_t* seq)
+{
+    uint32_t bs = sb->block_size;
+    uint8_t* head = (uint8_t*)malloc(bs);
+    uint64_t offset = journal_get_offset(sb, half);
+
+    if (pread(fd, head, bs, offset) != bs || ((uint32_t*)head)[0] != JOURNAL_MAGIC)
+    {
+        free(head);
+        return NULL;
+    }
+
+    uint32_t n = ((uint32_t*)head)[1];
+    uint32_t nhead = journal_get_head_blocks(sb, n);
+    if (nhead + n > sb->journal_len / 2)
+    {
+        free(head);
+        return NULL;
+    }
+
+    uint64_t len = (uint64_t)(nhead + n) * bs;
+    uint8_t* buf = (uint8_t*)realloc(head, len);
+    if (pread(fd, buf, len, offset) != (ssize_t)len)
+    {
+        free(buf);
+        return NULL;
+    }
+
+    uint64_t sum;
+    memcpy(&sum, buf + 16, sizeof(uint64_t));
+    memset(buf + 16, 0, sizeof(uint64_t));
+    if (journal_checksum(14695981039346656037ULL, buf, len) != sum)
+    {
+        free(buf);
+        return NULL;
+    }
+
+    memcpy(seq, buf + 8, sizeof(uint64_t));
+    *nblocks = n;
+    return buf;
+}
+
+int journal_replay(struct s_superblock* sb, int fd, uint64_t* seq)
+{
+    *seq = 0;
+    if (sb->journal_len == 0)
+        return 0;
+
+    uint8_t* best = NULL;
+    uint32_t i, n, bestn = 0;
+    uint64_t s, bestseq = 0;
+
+    for (i = 0; i < 2; ++i)
+    {
+        uint8_t* buf = journal_read(sb, fd, i, &n, &s);
+        if (buf && (best == NULL || s > bestseq))
+        {
+            free(best);
+            best = buf;
+            bestn = n;
+            bestseq = s;
+        }
+        else
+            free(buf);
+    }
+
+    if (best == NULL)
+        return 0;
+
+    uint32_t* tags = (uint32_t*)(best + JOURNAL_HEAD);
+    uint8_t* data = best + (uint64_t)journal_get_head_blocks(sb, bestn) * sb->block_size;
+
+    // the journal holds the only copy until the blocks are durable at home
+    int ok = 1;
+    for (i = 0; i < bestn && ok; ++i)
+        ok = pwrite(fd, data + (uint64_t)i * sb->block_size, sb->block_size, get_block_offset(sb, tags[i])) == sb->block_size;
+    ok = ok && fdatasync(fd) == 0;
+
+    uint32_t zero = 0;
+    for (i = 0; i < 2 && ok; ++i)
+        ok = pwrite(fd, &zero, sizeof(uint32_t), journal_get_offset(sb, i)) == sizeof(uint32_t);
+    ok = ok && fdatasync(fd) == 0;
+
+    free(best);
+    if (!ok)
+        return -EIO;
+
+    *seq = bestseq + 1;
+    return 0;
+}
+
+void journal_open(struct s_superblock* sb, uint64_t seq)
+{
+    if (sb->journal_len == 0 || sb->cache == NULL)
+        return;
+
+    struct s_journal* j = (struct s_journal*)malloc(sizeof(struct s_journal));
+    uint32_t half = sb->journal_len / 2;
+
+    j->seq = seq;
+    j->last = get_time_ns();
+    for (j->max = half - 1; j->max && journal_get_head_blocks(sb, j->max) + j->max > half; --(j->max));
+
+    // leave room for the bitmap and superblock blocks a commit adds itself,
+    // and for whatever the operation that crosses the line still dirties
+    sb->cache->hold_dirty = 1;
+    sb->cache->dirty_max = j->max / 2;
+
+    sb->journal = j;
+}
+
+int journal_close(struct s_superblock* sb, int fd, int clean)
+{
+    if (sb->journal == NULL)
+        return 0;
+
+    int ok = fdatasync(fd) == 0;
+
+    uint32_t i, zero = 0;
+    for (i = 0; clean && ok && i < 2; ++i)
+        ok = pwrite(fd, &zero, sizeof(uint32_t), journal_get_offset(sb, i)) == sizeof(uint32_t);
+    if (clean && ok)
+        ok = fdatasync(fd) == 0;
+
+    sb->cache->hold_dirty = 0;
+    free(sb->journal);
+    sb->journal = NULL;
+
+    return ok ? 0 : -EIO;
+}
+
+int journal_write(struct s_superblock* sb, int fd, struct s_cache_entry** dirty, uint32_t n)
+{
+    struct s_journal* j = sb->journal;
+    struct s_cache* cache = sb->cache;
+    uint32_t i, bs = sb->block_size;
+
+    uint32_t nhead = journal_get_head_blocks(sb, n);
+    uint8_t* head = (uint8_t*)calloc(nhead, bs);
+
+    ((uint32_t*)head)[0] = JOURNAL_MAGIC;
+    ((uint32_t*)head)[1] = n;
+    memcpy(head + 8, &j->seq, sizeof(uint64_t));
+    for (i = 0; i < n; ++i)
+        ((uint32_t*)(head + JOURNAL_HEAD))[i] = dirty[i]->nblock;
+
+    uint64_t sum = journal_checksum(14695981039346656037ULL, head, (uint64_t)nhead * bs);
+    for (i = 0; i < n; ++i)
+        sum = journal_checksum(sum, cache_get_data(sb, dirty[i] - cache->entries), bs);
+    memcpy(head + 16, &sum, sizeof(uint64_t));
+
+    // one sequential append: the header, then the blocks straight from the cache
+    struct iovec iov[IO_IOV];
+    uint64_t offset = journal_get_offset(sb, j->seq);
+    int cnt = 1, ok = 1;
+
+    iov[0].iov_base = head;
+    iov[0].iov_len = (uint64_t)nhead * bs;
+    for (i = 0; i <= n; ++i)
+    {
+        if (cnt == IO_IOV || i == n)
+        {
+            uint64_t len = 0;
+            int k;
+            for (k = 0; k < cnt; ++k)
+                len += iov[k].iov_len;
+
+            ok = pwritev(fd, iov, cnt, offset) == (ssize_t)len && ok;
+            offset += len;
+            cnt = 0;
+        }
+
+        if (i < n)
+        {
+            iov[cnt].iov_base = cache_get_data(sb, dirty[i] - cache->entries);
+            iov[cnt++].iov_len = bs;
+        }
+    }
+
+    ok = fdatasync(fd) == 0 && ok;
+    free(head);
+
+    // a transaction that did not make it must not be written home either;
+    // its blocks stay dirty for the next commit to try again
+    if (!ok)
+        return -EIO;
+
+    // checkpoint; made durable by the next commit's fdatasync
+    for (i = 0; i < n; ++i)
+    {
+        ok = io_queue_pwrite(sb, fd, cache_get_data(sb, dirty[i] - cache->entries), bs, get_block_offset(sb, dirty[i]->nblock)) && ok;
+        dirty[i]->dirty = 0;
+    }
+    ok = io_wait(sb) && ok;
+
+    cache->ndirty -= n;
+    ++(j->seq);
+
+    return ok ? 0 : -EIO;
+}
+
+int journal_commit(struct s_superblock* sb, int fd)
+{
+    struct s_journal* j = sb->journal;
+    uint32_t i, n, part;
+    int status = 0;
+
+    struct s_cache_entry** dirty = cache_get_dirty(sb, &n);
+
+    if (n > j->max)
+        fprintf(stderr, "minifs: warning: %u metadata blocks do not fit into one journal transaction of %u, "
+                        "committing them as %u; a crash in between leaves the operation partly applied\n",
+                n, j->max, (n + j->max - 1) / j->max);
+
+    for (i = 0; status == 0 && i < n; i += part)
+    {
+        part = n - i < j->max ? n - i : j->max;
+        status = journal_write(sb, fd, dirty + i, part);
+    }
+
+    free(dirty);
+    j->last = get_time_ns();
+
+    return status;
+}
+
+int journal_is_due(struct s_superblock* sb)
+{
+    return sb->journal && sb->cache->ndirty && get_time_ns() - sb->journal->last >= JOURNAL_INTERVAL;
+}
+
+int journal_is_full(struct s_superblock* sb)
+{
+    return sb->journal && sb->cache->ndirty >= sb->cache->dirty_max;
+}
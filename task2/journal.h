@@ -0,0 +1,89 @@
+#ifndef JOURNAL_H_INCLUDED
+#define JOURNAL_H_INCLUDED
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "superblock.h"
+#include "cache.h"
+#include "io.h"
+#include "utils.h"
+
+#define JOURNAL_MAGIC 0x314C4E4Au
+#define JOURNAL_INTERVAL 5000000000ULL
+#define JOURNAL_HEAD 24
+
+// Write-ahead metadata journal. Every metadata block goes through the block
+// cache, and dirty cache blocks are held back from the image until a commit
+// logs all of them as one transaction: a single sequential write into the
+// journal, one fdatasync, and only then the write-back to their home
+// locations. The journal is split in two halves used alternately, so the
+// write-back of one transaction is made durable by the fdatasync of the
+// next one before its half is reused. A transaction is
+//
+//     header  0  magic    4  nblocks    8  seq    16  checksum
+//            24  home block number of each logged block
+//     then the logged blocks in the same order,
+//
+// At mount the newest one with a valid checksum is written home again and
+// the journal is emptied, so a session that does not journal (mmap) can
+// never have its changes undone by a stale transaction.
+struct s_journal
+{
+    uint64_t seq;
+    uint32_t max;
+
+    uint64_t last;
+};
+
+uint32_t journal_get_head_blocks(struct s_superblock* sb, uint32_t n);
+
+uint64_t journal_get_offset(struct s_superblock* sb, uint64_t seq);
+
+// FNV-1a, 64 bit.
+uint64_t journal_checksum(uint64_t hash, const uint8_t* buf, uint64_t len);
+
+// Reads the transaction in the half seq lands in; returns its logged
+// blocks (header first) if it is complete and intact, NULL otherwise.
+uint8_t* journal_read(struct s_superblock* sb, int fd, uint64_t half, uint32_t* nblocks, uint64_t* seq);
+
+// Replays the newest committed transaction with plain pread/pwrite, before
+// anything else looks at the image, and puts the sequence number the next
+// transaction has to use in *seq, 0 if there was nothing to replay. Returns
+// -EIO, with the journal left as it was, if the transaction could not be
+// written home.
+int journal_replay(struct s_superblock* sb, int fd, uint64_t* seq);
+
+// Starts journaling the cache: from here on dirty blocks only leave it
+// through journal_commit, which is only run between two operations, so a
+// transaction never holds half of one.
+void journal_open(struct s_superblock* sb, uint64_t seq);
+
+// Ends journaling after the last commit. Its write-back is made durable and
+// the journal emptied, which marks the image as cleanly unmounted. Returns
+// 0 or -EIO. When the last commit failed (clean 0) the journal is left as
+// it is, for the next mount to replay.
+int journal_close(struct s_superblock* sb, int fd, int clean);
+
+// Logs n blocks as one transaction and writes them home.
+int journal_write(struct s_superblock* sb, int fd, struct s_cache_entry** dirty, uint32_t n);
+
+// Group commit of every dirty cache block, 0 or -EIO. When a single
+// operation dirtied more blocks than a journal half holds, they go out as
+// several transactions in a row and a warning says the operation is not
+// atomic.
+int journal_commit(struct s_superblock* sb, int fd);
+
+// Whether the running transaction is old enough to be committed at the next
+// operation boundary.
+int journal_is_due(struct s_superblock* sb);
+
+// Whether so many blocks are dirty that the next operation boundary has to
+// commit them, batch or not, for the transaction to still fit the journal.
+int journal_is_full(struct s_superblock* sb);
+
+#endif // JOURNAL_H_INCLUDED
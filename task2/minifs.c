@@ -0,0 +1,526 @@
+#include "minifs.h"
+#include "options.h"
+#include "superblock.h"
+#include "inode.h"
+#include "io.h"
+#include "fs.h"
+#include "tree.h"
+
+struct minifs
+{
+    struct s_superblock* sb;
+    int fd;
+    int flags;
+};
+
+struct minifs_file
+{
+    struct minifs* fs;
+    uint32_t ninode;
+    int flags;
+    uint64_t pos;
+};
+
+struct s_minifs_readdir
+{
+    minifs_dir_fn fn;
+    void* arg;
+};
+
+int minifs_mount(const char* image, int flags, struct minifs** fs)
+{
+    int fd = open(image, O_RDWR);
+    if (fd == -1)
+        return -errno;
+
+    struct s_superblock* sb;
+    superblock_init(&sb, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    superblock_read(sb, fd);
+
+    if (!superblock_is_supported(sb))
+    {
+        superblock_del(sb);
+        close(fd);
+        return -EPROTO;
+    }
+
+    superblock_upgrade(sb, fd);
+
+    // a replayed transaction may have rewritten the superblock
+    uint64_t seq;
+    if (journal_replay(sb, fd, &seq) != 0)
+    {
+        superblock_del(sb);
+        close(fd);
+        return -EIO;
+    }
+
+    if (seq)
+    {
+        lseek(fd, 0, SEEK_SET);
+        superblock_read(sb, fd);
+    }
+
+    int io_type = IO_PREAD;
+    if (flags & MINIFS_MMAP)
+        io_type = IO_MMAP;
+    else if (flags & MINIFS_URING)
+        io_type = IO_URING;
+
+    if (!io_open(sb, fd, io_type))
+    {
+        int error = -errno;
+        superblock_del(sb);
+        close(fd);
+        return error;
+    }
+
+    bitmap_load(sb, fd);
+
+    // the mapping already is a cache of the whole image
+    if (io_type != IO_MMAP)
+        cache_init(sb, CACHE_SIZE / sb->block_size);
+
+    dcache_init(sb, DCACHE_SIZE);
+
+    journal_open(sb, seq);
+
+    *fs = (struct minifs*)malloc(sizeof(struct minifs));
+    (*fs)->sb = sb;
+    (*fs)->fd = fd;
+    (*fs)->flags = flags;
+
+    return 0;
+}
+
+int minifs_unmount(struct minifs* fs)
+{
+    struct s_superblock* sb = fs->sb;
+
+    int status = fs_sync(sb, fs->fd);
+
+    // after a failed commit the journal keeps the last transaction that made
+    // it for the next mount, and nothing newer may reach the image now
+    if (status != 0 && sb->journal)
+        cache_drop_dirty(sb);
+
+    int error = journal_close(sb, fs->fd, status == 0);
+    if (status == 0)
+        status = error;
+
+    if (!cache_del(sb, fs->fd) && status == 0)
+        status = -EIO;
+
+    dirsize_del(sb);
+    dcache_del(sb);
+    bitmap_unload(sb);
+    io_close(sb);
+    superblock_del(sb);
+
+    if (close(fs->fd) == -1 && status == 0)
+        status = -errno;
+
+    free(fs);
+    return status;
+}
+
+// Group commit: changes pile up in the cache and go out together once the
+// running transaction is JOURNAL_INTERVAL old, or in a batch too once it
+// would not fit the journal any more. Run after every operation, so
+// transactions hold whole ones.
+void minifs_tick(struct minifs* fs)
+{
+    if (journal_is_full(fs->sb) || (!(fs->flags & MINIFS_BATCH) && journal_is_due(fs->sb)))
+        fs_sync(fs->sb, fs->fd);
+}
+
+int minifs_sync(struct minifs* fs)
+{
+    return fs_sync(fs->sb, fs->fd);
+}
+
+int minifs_statfs(struct minifs* fs, struct minifs_statfs* st)
+{
+    struct s_superblock* sb = fs->sb;
+
+    st->block_size = sb->block_size;
+    st->blocks_total = sb->blocks_total;
+    st->blocks_free = sb->blocks_remain;
+    st->inodes_total = sb->inodes_total;
+    st->inodes_free = sb->inodes_remain;
+
+    st->io = 0;
+    if (sb->io->type == IO_MMAP)
+        st->io = MINIFS_MMAP;
+    else if (sb->io->type == IO_URING)
+        st->io = MINIFS_URING;
+
+    st->cache_hits = sb->cache ? sb->cache->hits : 0;
+    st->cache_misses = sb->cache ? sb->cache->misses : 0;
+    st->dentry_hits = sb->dcache->hits;
+    st->dentry_misses = sb->dcache->misses;
+
+    return 0;
+}
+
+void minifs_stat_fill(struct minifs* fs, struct s_inode* node, struct minifs_stat* st)
+{
+    st->ino = node->ninode;
+    st->type = node->type;
+    st->usage = node->size + dirsize_get(fs->sb, node->ninode);
+    st->size = node->type == 'd' ? st->usage : st->usage - INODE_SIZE;
+    st->nblocks = node->nblocks;
+    st->ctime = node->ctime;
+    st->mtime = node->mtime;
+    st->atime = node->atime;
+}
+
+int minifs_stat(struct minifs* fs, const char* path, struct minifs_stat* st)
+{
+    struct s_inode* node;
+    inode_init(&node, 0, 0, "", 0);
+
+    int status = fs_resolve(fs->sb, fs->fd, path, node);
+    if (status == 0)
+        minifs_stat_fill(fs, node, st);
+
+    inode_del(node);
+    return status;
+}
+
+int minifs_fstat(struct minifs_file* file, struct minifs_stat* st)
+{
+    struct s_inode* node;
+    inode_init(&node, 0, 0, "", 0);
+    inode_read(node, file->fs->sb, file->fs->fd, file->ninode);
+
+    minifs_stat_fill(file->fs, node, st);
+
+    inode_del(node);
+    return 0;
+}
+
+int minifs_readdir_entry(void* arg, struct s_dirent* de)
+{
+    struct s_minifs_readdir* rd = (struct s_minifs_readdir*)arg;
+    struct minifs_dirent out;
+
+    out.ino = de->ninode;
+    out.type = de->type;
+    out.usage = de->size;
+    out.size = de->type == 'd' ? out.usage : out.usage - INODE_SIZE;
+    out.mtime = de->mtime;
+    memcpy(out.name, de->name, de->name_len + 1);
+
+    return rd->fn(rd->arg, &out);
+}
+
+int minifs_readdir(struct minifs* fs, const char* path, minifs_dir_fn fn, void* arg)
+{
+    struct s_inode* node;
+    inode_init(&node, 0, 0, "", 0);
+
+    int status = fs_resolve(fs->sb, fs->fd, path, node);
+    if (status == 0 && node->type != 'd')
+        status = -ENOTDIR;
+
+    if (status == 0)
+    {
+        struct s_minifs_readdir rd;
+        rd.fn = fn;
+        rd.arg = arg;
+        status = fs_readdir(fs->sb, fs->fd, node, minifs_readdir_entry, &rd);
+    }
+
+    inode_del(node);
+    return status;
+}
+
+int minifs_mkdir(struct minifs* fs, const char* path)
+{
+    struct s_inode* dir;
+    inode_init(&dir, 0, 0, "", 0);
+
+    char name[NAME_LEN];
+    uint32_t ninode;
+
+    int status = fs_resolve_parent(fs->sb, fs->fd, path, dir, name);
+    if (status == 0)
+        status = fs_make_dir(fs->sb, fs->fd, dir, name, &ninode);
+
+    inode_del(dir);
+    minifs_tick(fs);
+
+    return status;
+}
+
+int minifs_remove(struct minifs* fs, const char* path)
+{
+    struct s_inode* dir;
+    inode_init(&dir, 0, 0, "", 0);
+
+    char name[NAME_LEN];
+
+    int status = fs_resolve_parent(fs->sb, fs->fd, path, dir, name);
+    if (status == 0)
+        status = fs_remove(fs->sb, fs->fd, dir, name);
+
+    inode_del(dir);
+    minifs_tick(fs);
+
+    return status;
+}
+
+int minifs_open(struct minifs* fs, const char* path, int flags, struct minifs_file** file)
+{
+    struct s_inode* node;
+    inode_init(&node, 0, 0, "", 0);
+
+    char name[NAME_LEN];
+    uint32_t ninode = 0;
+
+    int status = fs_resolve_parent(fs->sb, fs->fd, path, node, name);
+    if (status == 0)
+    {
+        ninode = fs_find_ninode(fs->sb, fs->fd, node, name);
+
+        if (ninode && (flags & MINIFS_CREATE) && (flags & MINIFS_EXCL))
+            status = -EEXIST;
+        else if (ninode == 0 && !(flags & MINIFS_CREATE))
+            status = -ENOENT;
+        else if (ninode == 0)
+            status = fs_make_node(fs->sb, fs->fd, node, name, '-', &ninode);
+    }
+
+    if (status == 0)
+    {
+        inode_read(node, fs->sb, fs->fd, ninode);
+
+        if (node->type != '-')
+            status = -EISDIR;
+        else if ((flags & MINIFS_WRITE) && (flags & MINIFS_TRUNC) && node->size > INODE_SIZE)
+            status = fs_truncate(fs->sb, fs->fd, node, 0);
+    }
+
+    if (status == 0)
+    {
+        *file = (struct minifs_file*)malloc(sizeof(struct minifs_file));
+        (*file)->fs = fs;
+        (*file)->ninode = ninode;
+        (*file)->flags = flags;
+        (*file)->pos = 0;
+    }
+
+    inode_del(node);
+    minifs_tick(fs);
+
+    return status;
+}
+
+ssize_t minifs_pread(struct minifs_file* file, void* buf, size_t len, uint64_t off)
+{
+    if (!(file->flags & MINIFS_READ))
+        return -EBADF;
+
+    struct minifs* fs = file->fs;
+    struct s_inode* node;
+    inode_init(&node, 0, 0, "", 0);
+    inode_read(node, fs->sb, fs->fd, file->ninode);
+
+    int64_t n = fs_pread(fs->sb, fs->fd, node, (uint8_t*)buf, len, off);
+
+    inode_del(node);
+    return n;
+}
+
+ssize_t minifs_pwrite(struct minifs_file* file, const void* buf, size_t len, uint64_t off)
+{
+    if (!(file->flags & MINIFS_WRITE))
+        return -EBADF;
+
+    struct minifs* fs = file->fs;
+    struct s_inode* node;
+    inode_init(&node, 0, 0, "", 0);
+    inode_read(node, fs->sb, fs->fd, file->ninode);
+
+    int64_t n = fs_pwrite(fs->sb, fs->fd, node, (const uint8_t*)buf, len, off);
+
+    inode_del(node);
+    minifs_tick(fs);
+
+    return n;
+}
+
+ssize_t minifs_read(struct minifs_file* file, void* buf, size_t len)
+{
+    ssize_t n = minifs_pread(file, buf, len, file->pos);
+    if (n > 0)
+        file->pos += n;
+
+    return n;
+}
+
+ssize_t minifs_write(struct minifs_file* file, const void* buf, size_t len)
+{
+    if ((file->flags & MINIFS_APPEND) && (file->flags & MINIFS_WRITE))
+    {
+        struct minifs_stat st;
+        minifs_fstat(file, &st);
+        file->pos = st.size;
+    }
+
+    ssize_t n = minifs_pwrite(file, buf, len, file->pos);
+    if (n > 0)
+        file->pos += n;
+
+    return n;
+}
+
+int minifs_ftruncate(struct minifs_file* file, uint64_t size)
+{
+    if (!(file->flags & MINIFS_WRITE))
+        return -EBADF;
+
+    struct minifs* fs = file->fs;
+    struct s_inode* node;
+    inode_init(&node, 0, 0, "", 0);
+    inode_read(node, fs->sb, fs->fd, file->ninode);
+
+    int status = fs_truncate(fs->sb, fs->fd, node, size);
+
+    inode_del(node);
+    minifs_tick(fs);
+
+    return status;
+}
+
+int minifs_truncate(struct minifs* fs, const char* path, uint64_t size)
+{
+    struct s_inode* node;
+    inode_init(&node, 0, 0, "", 0);
+
+    int status = fs_resolve(fs->sb, fs->fd, path, node);
+    if (status == 0)
+        status = fs_truncate(fs->sb, fs->fd, node, size);
+
+    inode_del(node);
+    minifs_tick(fs);
+
+    return status;
+}
+
+int minifs_utimens(struct minifs* fs, const char* path, uint64_t atime, uint64_t mtime)
+{
+    struct s_inode* node;
+    inode_init(&node, 0, 0, "", 0);
+
+    int status = fs_resolve(fs->sb, fs->fd, path, node);
+    if (status == 0)
+        fs_set_times(fs->sb, fs->fd, node, atime, mtime);
+
+    inode_del(node);
+    minifs_tick(fs);
+
+    return status;
+}
+
+int minifs_close(struct minifs_file* file)
+{
+    free(file);
+    return 0;
+}
+
+int minifs_import(struct minifs* fs, const char* host, const char* path)
+{
+    struct s_inode* dir;
+    inode_init(&dir, 0, 0, "", 0);
+
+    char name[NAME_LEN];
+
+    int status = fs_resolve_parent(fs->sb, fs->fd, path, dir, name);
+    if (status == 0)
+        status = fs_pull(fs->sb, fs->fd, dir, host, name);
+
+    inode_del(dir);
+    minifs_tick(fs);
+
+    return status;
+}
+
+int minifs_export(struct minifs* fs, const char* path, const char* host)
+{
+    struct s_inode* node;
+    inode_init(&node, 0, 0, "", 0);
+
+    int status = fs_resolve(fs->sb, fs->fd, path, node);
+    if (status == 0)
+        status = fs_push(fs->sb, fs->fd, node, host);
+
+    inode_del(node);
+    minifs_tick(fs);
+
+    return status;
+}
+
+void minifs_tree_stats_init(struct s_tree_stats* stats, struct minifs_tree_stats* out)
+{
+    memset(stats, 0, sizeof(struct s_tree_stats));
+    stats->report = out->report;
+    stats->arg = out->arg;
+}
+
+void minifs_tree_stats_get(struct s_tree_stats* stats, struct minifs_tree_stats* out)
+{
+    out->ndirs = stats->ndirs;
+    out->nfiles = stats->nfiles;
+    out->bytes = stats->bytes;
+    out->failed = stats->failed;
+    out->skipped = stats->skipped;
+    out->ns = stats->ns;
+}
+
+int minifs_import_tree(struct minifs* fs, const char* host, const char* path, struct minifs_tree_stats* stats)
+{
+    struct s_inode* dir;
+    inode_init(&dir, 0, 0, "", 0);
+
+    char name[NAME_LEN];
+    struct s_tree_stats ts;
+    minifs_tree_stats_init(&ts, stats);
+
+    int status = fs_resolve_parent(fs->sb, fs->fd, path, dir, name);
+    if (status == 0)
+        status = fs_pull_tree(fs->sb, fs->fd, dir, host, name, &ts);
+
+    minifs_tree_stats_get(&ts, stats);
+
+    inode_del(dir);
+    minifs_tick(fs);
+
+    return status;
+}
+
+int minifs_export_tree(struct minifs* fs, const char* path, const char* host, struct minifs_tree_stats* stats)
+{
+    struct s_inode* dir;
+    inode_init(&dir, 0, 0, "", 0);
+
+    struct s_tree_stats ts;
+    minifs_tree_stats_init(&ts, stats);
+
+    int status = fs_resolve(fs->sb, fs->fd, path, dir);
+    if (status == 0)
+        status = fs_push_tree(fs->sb, fs->fd, dir, host, &ts);
+
+    minifs_tree_stats_get(&ts, stats);
+
+    inode_del(dir);
+    minifs_tick(fs);
+
+    return status;
+}
+
+const char* minifs_strerror(int error)
+{
+    return fs_strerror(error);
+}
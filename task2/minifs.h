@@ -0,0 +1,168 @@
+#ifndef MINIFS_H_INCLUDED
+#define MINIFS_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// libminifs: in-process access to a MiniFS image. A mount handle owns the
+// image until minifs_unmount; calls on one handle must not run at the same
+// time. Paths are absolute inside the image, the leading slash is optional,
+// and may contain "." and "..". Unless said otherwise a call returns 0 on
+// success and a negative errno value on failure, see minifs_strerror.
+
+#define MINIFS_NAME_MAX 30
+
+// minifs_mount flags
+#define MINIFS_MMAP 1   // access the image through mmap instead of pread/pwrite
+#define MINIFS_URING 2  // batch block I/O on an io_uring if the kernel has one
+#define MINIFS_BATCH 4  // no periodic commit, metadata stays cached until minifs_sync
+
+// minifs_open flags
+#define MINIFS_READ 1
+#define MINIFS_WRITE 2
+#define MINIFS_CREATE 4 // create the file if it does not exist
+#define MINIFS_EXCL 8   // with MINIFS_CREATE, fail if it does
+#define MINIFS_TRUNC 16 // drop the contents of the file
+#define MINIFS_APPEND 32 // minifs_write always goes to the end of the file
+
+struct minifs;
+struct minifs_file;
+
+// size is the length of a file and the bytes accounted to the whole subtree
+// of a directory; usage is what the object takes up in the image, its own
+// inode included. Times are nanoseconds since the epoch.
+struct minifs_stat
+{
+    uint32_t ino;
+    char type; // 'd' directory, '-' regular file
+
+    uint64_t size;
+    uint64_t usage;
+    uint32_t nblocks;
+
+    uint64_t ctime;
+    uint64_t mtime;
+    uint64_t atime;
+};
+
+// Directory entries carry a copy of the size and mtime of the object, so
+// listing a directory does not read any of its children.
+struct minifs_dirent
+{
+    uint32_t ino;
+    char type;
+
+    uint64_t size;
+    uint64_t usage;
+    uint64_t mtime;
+
+    char name[MINIFS_NAME_MAX + 1];
+};
+
+// Returns 0 to go on; anything else stops minifs_readdir, which returns it.
+typedef int (*minifs_dir_fn)(void* arg, const struct minifs_dirent* de);
+
+struct minifs_statfs
+{
+    uint32_t block_size;
+    uint32_t blocks_total;
+    uint32_t blocks_free;
+    uint32_t inodes_total;
+    uint32_t inodes_free;
+
+    // MINIFS_MMAP, MINIFS_URING or 0 for plain pread/pwrite, whichever is in use
+    int io;
+
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+
+    // path components answered by the dentry cache, and looked up on the image
+    uint64_t dentry_hits;
+    uint64_t dentry_misses;
+};
+
+// Outcome of a tree import or export. report, when set, is told about every
+// object that was skipped or could not be copied, from whatever thread
+// copies it but never from two at once.
+struct minifs_tree_stats
+{
+    uint32_t ndirs;
+    uint32_t nfiles;
+    uint64_t bytes;
+    uint32_t failed;
+    uint32_t skipped;
+    uint64_t ns;
+
+    void (*report)(void* arg, const char* path, int error);
+    void* arg;
+};
+
+// Replays the journal if the image was not unmounted cleanly.
+int minifs_mount(const char* image, int flags, struct minifs** fs);
+
+// Commits everything and releases the image. The handle is gone either way;
+// an error means the last changes may not have reached the image.
+int minifs_unmount(struct minifs* fs);
+
+// Makes every change so far durable.
+int minifs_sync(struct minifs* fs);
+
+int minifs_statfs(struct minifs* fs, struct minifs_statfs* st);
+
+int minifs_stat(struct minifs* fs, const char* path, struct minifs_stat* st);
+
+int minifs_readdir(struct minifs* fs, const char* path, minifs_dir_fn fn, void* arg);
+
+int minifs_mkdir(struct minifs* fs, const char* path);
+
+// Removes a file or an empty directory.
+int minifs_remove(struct minifs* fs, const char* path);
+
+int minifs_open(struct minifs* fs, const char* path, int flags, struct minifs_file** file);
+
+int minifs_fstat(struct minifs_file* file, struct minifs_stat* st);
+
+// Reads up to len bytes at offset off; returns the number of bytes read, 0
+// at the end of the file. Only the blocks the range covers are touched.
+ssize_t minifs_pread(struct minifs_file* file, void* buf, size_t len, uint64_t off);
+
+// Writes len bytes at offset off and returns len. Blocks past the end are
+// allocated on the way, and a gap between the end and off reads as zeros.
+ssize_t minifs_pwrite(struct minifs_file* file, const void* buf, size_t len, uint64_t off);
+
+// minifs_pread and minifs_pwrite at the current position, which they move
+// along; with MINIFS_APPEND every write first moves it to the end.
+ssize_t minifs_read(struct minifs_file* file, void* buf, size_t len);
+
+ssize_t minifs_write(struct minifs_file* file, const void* buf, size_t len);
+
+// Cuts a file down to size bytes, giving the blocks past it back, or
+// extends it with zeros.
+int minifs_ftruncate(struct minifs_file* file, uint64_t size);
+
+int minifs_truncate(struct minifs* fs, const char* path, uint64_t size);
+
+// Sets the access and modification times, in nanoseconds since the epoch.
+int minifs_utimens(struct minifs* fs, const char* path, uint64_t atime, uint64_t mtime);
+
+int minifs_close(struct minifs_file* file);
+
+// Copies host file host into the image as the new file path.
+int minifs_import(struct minifs* fs, const char* host, const char* path);
+
+// Copies file path out to host file host, replacing it.
+int minifs_export(struct minifs* fs, const char* path, const char* host);
+
+// Imports host directory host as the new directory path, reading the files
+// on a pool of threads. Objects that fail on their own are counted in
+// stats; the call itself only fails when nothing could be imported.
+int minifs_import_tree(struct minifs* fs, const char* host, const char* path, struct minifs_tree_stats* stats);
+
+// Exports directory path as the new host directory host, writing the files
+// on a pool of threads.
+int minifs_export_tree(struct minifs* fs, const char* path, const char* host, struct minifs_tree_stats* stats);
+
+const char* minifs_strerror(int error);
+
+#endif // MINIFS_H_INCLUDED
@@ -1,10 +1,29 @@
 #ifndef OPTIONS_H_INCLUDED
 #define OPTIONS_H_INCLUDED
 
-#define SUPER_SIZE 28
+#define SUPER_SIZE 56
 #define MAGIC 0xEF53
 
-#define BLOCKS_TOTAL 1048576
-#define BLOCK_SIZE 128
+// Format revisions: 1 packed inodes, 2 hashed directories, 3 names inline in
+// directory entries, 4 indirect blocks, 5 image geometry in the superblock,
+// 6 inode table, 7 binary times, 8 journal. Revisions 2 to 7 each changed how
+// inodes or directories are laid out, and an image of an earlier revision
+// cannot be read and has to be recreated with fs_init. Revision 8 only added
+// the journal fields to the superblock: a revision 7 image reads as a
+// revision 8 one without a journal and is upgraded in place at mount.
+//
+// Inodes and directory blocks are little-endian and the bitmap is a byte
+// array; the superblock, the block map index blocks and the journal headers
+// are still written in host order, so an image only moves between hosts of
+// the same byte order.
+#define REVISION 8
+#define REVISION_MIN 7
+
+#define IMAGE_SIZE 134217728ULL
+#define BLOCK_SIZE 4096
+#define BLOCK_SIZE_MIN 512
+#define BLOCK_SIZE_MAX 65536
+#define INODE_RATIO 4096
+#define JOURNAL_SIZE 4194304
 
 #endif // OPTIONS_H_INCLUDED
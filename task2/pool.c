@@ -0,0 +1,187 @@
+#include "pool.h"
+
+uint32_t pool_get_ncpus()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+void pool_init(struct s_pool** pool, uint32_t nthreads, pool_fn run, void* ctx)
+{
+    uint32_t i;
+
+    *pool = (struct s_pool*)malloc(sizeof(struct s_pool));
+
+    (*pool)->nthreads = nthreads ? nthreads : 1;
+    (*pool)->queues = (struct s_pool_queue*)malloc((*pool)->nthreads * sizeof(struct s_pool_queue));
+    (*pool)->workers = (struct s_pool_worker*)malloc((*pool)->nthreads * sizeof(struct s_pool_worker));
+
+    for (i = 0; i < (*pool)->nthreads; ++i)
+    {
+        struct s_pool_queue* q = (*pool)->queues + i;
+
+        pthread_mutex_init(&q->lock, NULL);
+        q->capacity = POOL_QUEUE;
+        q->tasks = (void**)malloc(q->capacity * sizeof(void*));
+        q->head = 0;
+        q->tail = 0;
+    }
+
+    (*pool)->run = run;
+    (*pool)->ctx = ctx;
+
+    (*pool)->pending = 0;
+    (*pool)->queued = 0;
+    (*pool)->steals = 0;
+
+    pthread_mutex_init(&(*pool)->idle_lock, NULL);
+    pthread_cond_init(&(*pool)->idle, NULL);
+    (*pool)->nidle = 0;
+}
+
+void pool_del(struct s_pool* pool)
+{
+    uint32_t i;
+    for (i = 0; i < pool->nthreads; ++i)
+    {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+        free(pool->queues[i].tasks);
+    }
+
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle);
+
+    free(pool->queues);
+    free(pool->workers);
+    free(pool);
+}
+
+void pool_push(struct s_pool* pool, uint32_t worker, void* task)
+{
+    struct s_pool_queue* q = pool->queues + worker % pool->nthreads;
+
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&q->lock);
+    if (q->tail - q->head == q->capacity)
+    {
+        // unwrap into a buffer twice the size
+        void** tasks = (void**)malloc(2 * q->capacity * sizeof(void*));
+        uint32_t i;
+        for (i = 0; i < q->capacity; ++i)
+            tasks[i] = q->tasks[(q->head + i) % q->capacity];
+
+        free(q->tasks);
+        q->tasks = tasks;
+        q->head = 0;
+        q->tail = q->capacity;
+        q->capacity *= 2;
+    }
+    q->tasks[q->tail++ % q->capacity] = task;
+    pthread_mutex_unlock(&q->lock);
+
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->nidle, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_signal(&pool->idle);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+void* pool_take(struct s_pool* pool, struct s_pool_queue* q, int own)
+{
+    void* task = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->tail != q->head)
+    {
+        if (own)
+            task = q->tasks[--(q->tail) % q->capacity];
+        else
+            task = q->tasks[(q->head)++ % q->capacity];
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    if (task)
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+
+    return task;
+}
+
+void* pool_worker_main(void* arg)
+{
+    struct s_pool_worker* w = (struct s_pool_worker*)arg;
+    struct s_pool* pool = w->pool;
+    uint32_t i;
+
+    for (;;)
+    {
+        void* task = pool_take(pool, pool->queues + w->id, 1);
+
+        for (i = 1; task == NULL && i < pool->nthreads; ++i)
+        {
+            task = pool_take(pool, pool->queues + (w->id + i) % pool->nthreads, 0);
+            if (task)
+                __atomic_add_fetch(&pool->steals, 1, __ATOMIC_RELAXED);
+        }
+
+        if (task)
+        {
+            pool->run(pool, w->id, task);
+
+            if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0)
+            {
+                pthread_mutex_lock(&pool->idle_lock);
+                pthread_cond_broadcast(&pool->idle);
+                pthread_mutex_unlock(&pool->idle_lock);
+            }
+            continue;
+        }
+
+        // nothing to steal: sleep until a task is queued or all are done
+        pthread_mutex_lock(&pool->idle_lock);
+        __atomic_add_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0 && __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) != 0)
+            pthread_cond_wait(&pool->idle, &pool->idle_lock);
+        __atomic_sub_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->idle_lock);
+
+        if (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0)
+            return NULL;
+    }
+}
+
+void pool_start(struct s_pool* pool)
+{
+    // the caller's own share: workers keep waiting for tasks until pool_wait
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+
+    uint32_t i;
+    for (i = 0; i < pool->nthreads; ++i)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        pthread_create(&pool->workers[i].thread, NULL, pool_worker_main, pool->workers + i);
+    }
+}
+
+void pool_wait(struct s_pool* pool)
+{
+    if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_broadcast(&pool->idle);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+
+    uint32_t i;
+    for (i = 0; i < pool->nthreads; ++i)
+        pthread_join(pool->workers[i].thread, NULL);
+}
+
+void pool_run(struct s_pool* pool)
+{
+    pool_start(pool);
+    pool_wait(pool);
+}
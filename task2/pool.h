@@ -0,0 +1,79 @@
+#ifndef POOL_H_INCLUDED
+#define POOL_H_INCLUDED
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define POOL_QUEUE 64
+
+// Work-stealing thread pool. Every worker owns a deque: it pushes and pops
+// its own tasks at the tail (depth first, so the working set stays small)
+// and, once it runs dry, steals the oldest task at the head of another
+// worker's deque. Tasks may push more tasks; pool_run returns when no task
+// is left anywhere.
+struct s_pool;
+
+typedef void (*pool_fn)(struct s_pool* pool, uint32_t worker, void* task);
+
+struct s_pool_queue
+{
+    pthread_mutex_t lock;
+
+    void** tasks;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t capacity;
+};
+
+struct s_pool_worker
+{
+    struct s_pool* pool;
+    uint32_t id;
+    pthread_t thread;
+};
+
+struct s_pool
+{
+    uint32_t nthreads;
+    struct s_pool_queue* queues;
+    struct s_pool_worker* workers;
+
+    pool_fn run;
+    void* ctx;
+
+    // tasks not finished yet and tasks sitting in a deque
+    uint64_t pending;
+    uint64_t queued;
+    uint64_t steals;
+
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle;
+    uint32_t nidle;
+};
+
+uint32_t pool_get_ncpus();
+
+void pool_init(struct s_pool** pool, uint32_t nthreads, pool_fn run, void* ctx);
+
+void pool_del(struct s_pool* pool);
+
+// Queues a task on the deque of worker; from outside the pool any worker
+// number will do.
+void pool_push(struct s_pool* pool, uint32_t worker, void* task);
+
+void* pool_take(struct s_pool* pool, struct s_pool_queue* q, int own);
+
+void* pool_worker_main(void* arg);
+
+// Starts the workers on the queued tasks; the caller is free to do other
+// work, and to queue more tasks, until pool_wait.
+void pool_start(struct s_pool* pool);
+
+// Waits until the queued tasks, and whatever they queue in turn, are done.
+void pool_wait(struct s_pool* pool);
+
+void pool_run(struct s_pool* pool);
+
+#endif // POOL_H_INCLUDED
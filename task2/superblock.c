@@ -0,0 +1,93 @@
+#include "superblock.h"
+
+void superblock_init(
+    struct s_superblock** sb,
+    uint32_t blocks_total,
+    uint32_t blocks_remain,
+    uint32_t block_size,
+    uint32_t inode_size,
+    uint32_t bitmap_offset,
+    uint32_t root_inode,
+    uint32_t magic,
+    uint32_t rev_level,
+    uint32_t inodes_total,
+    uint32_t inodes_remain,
+    uint32_t inode_bitmap_offset,
+    uint32_t inode_table,
+    uint32_t journal_block,
+    uint32_t journal_len)
+{
+    *sb = (struct s_superblock*)malloc(sizeof(struct s_superblock));
+
+    (*sb)->blocks_total = blocks_total;
+    (*sb)->blocks_remain = blocks_remain;
+    (*sb)->block_size = block_size;
+    (*sb)->inode_size = inode_size;
+    (*sb)->bitmap_offset = bitmap_offset;
+    (*sb)->root_inode = root_inode;
+    (*sb)->magic = magic;
+    (*sb)->rev_level = rev_level;
+    (*sb)->inodes_total = inodes_total;
+    (*sb)->inodes_remain = inodes_remain;
+    (*sb)->inode_bitmap_offset = inode_bitmap_offset;
+    (*sb)->inode_table = inode_table;
+    (*sb)->journal_block = journal_block;
+    (*sb)->journal_len = journal_len;
+
+    (*sb)->bitmap = NULL;
+    (*sb)->inode_bitmap = NULL;
+    (*sb)->cache = NULL;
+    (*sb)->io = NULL;
+    (*sb)->dirsize = NULL;
+    (*sb)->dcache = NULL;
+    (*sb)->journal = NULL;
+}
+
+void superblock_del(struct s_superblock* sb)
+{
+    free(sb);
+}
+
+uint32_t superblock_get_size(struct s_superblock* sb)
+{
+    return sb->bitmap_offset < SUPER_SIZE ? sb->bitmap_offset : SUPER_SIZE;
+}
+
+int superblock_is_supported(struct s_superblock* sb)
+{
+    return sb->magic == MAGIC && sb->rev_level >= REVISION_MIN && sb->rev_level <= REVISION;
+}
+
+void superblock_upgrade(struct s_superblock* sb, int fd)
+{
+    if (sb->rev_level == REVISION)
+        return;
+
+    // 7 to 8: the short superblock already reads as one with an empty journal
+    sb->rev_level = REVISION;
+    superblock_sync(sb, fd);
+}
+
+void superblock_read(struct s_superblock* sb, int fd)
+{
+    read(fd, sb, SUPER_SIZE);
+
+    uint32_t size = superblock_get_size(sb);
+    if (size < SUPER_SIZE)
+    {
+        memset((uint8_t*)sb + size, 0, SUPER_SIZE - size);
+
+        // an empty journal where fs_init -j 0 puts it, behind the inode table
+        sb->journal_block = sb->inode_table + ((uint64_t)sb->inodes_total * sb->inode_size + sb->block_size - 1) / sb->block_size;
+    }
+}
+
+void superblock_write(struct s_superblock* sb, int fd)
+{
+    write(fd, sb, SUPER_SIZE);
+}
+
+void superblock_sync(struct s_superblock* sb, int fd)
+{
+    pwrite(fd, sb, superblock_get_size(sb), 0);
+}
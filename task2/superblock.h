@@ -3,7 +3,21 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include "options.h"
+
+struct s_bitmap;
+struct s_cache;
+struct s_io;
+struct s_dirsize;
+struct s_dcache;
+struct s_journal;
+
+// On-disk layout (revision 8): this record, the block bitmap at
+// bitmap_offset and the inode bitmap at inode_bitmap_offset share the first
+// blocks of the image; the inode table starts at block inode_table, the
+// journal_len blocks of the journal at journal_block, and data blocks follow.
 
 struct s_superblock
 {
@@ -14,9 +28,28 @@ struct s_superblock
     uint32_t inode_size;
 
     uint32_t bitmap_offset;
-    uint32_t root_block;
+    uint32_t root_inode;
 
     uint32_t magic;
+    uint32_t rev_level;
+
+    uint32_t inodes_total;
+    uint32_t inodes_remain;
+
+    uint32_t inode_bitmap_offset;
+    uint32_t inode_table;
+
+    uint32_t journal_block;
+    uint32_t journal_len;
+
+    // in-memory only, not part of the SUPER_SIZE on-disk record
+    struct s_bitmap* bitmap;
+    struct s_bitmap* inode_bitmap;
+    struct s_cache* cache;
+    struct s_io* io;
+    struct s_dirsize* dirsize;
+    struct s_dcache* dcache;
+    struct s_journal* journal;
 };
 
 void superblock_init(
@@ -26,33 +59,33 @@ void superblock_init(
     uint32_t block_size,
     uint32_t inode_size,
     uint32_t bitmap_offset,
-    uint32_t root_block,
-    uint32_t magic)
-{
-    *sb = (struct s_superblock*)malloc(sizeof(struct s_superblock));
-
-    (*sb)->blocks_total = blocks_total;
-    (*sb)->blocks_remain = blocks_remain;
-    (*sb)->block_size = block_size;
-    (*sb)->inode_size = inode_size;
-    (*sb)->bitmap_offset = bitmap_offset;
-    (*sb)->root_block = root_block;
-    (*sb)->magic = magic;
-}
-
-void superblock_del(struct s_superblock* sb)
-{
-    free(sb);
-}
+    uint32_t root_inode,
+    uint32_t magic,
+    uint32_t rev_level,
+    uint32_t inodes_total,
+    uint32_t inodes_remain,
+    uint32_t inode_bitmap_offset,
+    uint32_t inode_table,
+    uint32_t journal_block,
+    uint32_t journal_len);
 
-void superblock_read(struct s_superblock* sb, int fd)
-{
-    read(fd, sb, sizeof(struct s_superblock));
-}
+void superblock_del(struct s_superblock* sb);
 
-void superblock_write(struct s_superblock* sb, int fd)
-{
-    write(fd, sb, sizeof(struct s_superblock));
-}
+// Revision 7 images have a 48-byte superblock with the bitmap right behind
+// it; the journal fields they lack read as an empty journal behind the inode
+// table, and they are never written past their own superblock.
+uint32_t superblock_get_size(struct s_superblock* sb);
+
+// Returns 1 if the image is of a revision from REVISION_MIN to REVISION.
+int superblock_is_supported(struct s_superblock* sb);
+
+// Brings a supported image of an older revision up to REVISION on disk.
+void superblock_upgrade(struct s_superblock* sb, int fd);
+
+void superblock_read(struct s_superblock* sb, int fd);
+
+void superblock_write(struct s_superblock* sb, int fd);
+
+void superblock_sync(struct s_superblock* sb, int fd);
 
 #endif // SUPERBLOCK_H_INCLUDED
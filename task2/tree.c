@@ -0,0 +1,562 @@
+#include "tree.h"
+
+void tree_report(struct s_tree_stats* stats, const char* path, int error)
+{
+    if (stats->report)
+        stats->report(stats->arg, path, error);
+}
+
+void tree_init(struct s_tree* tree, struct s_tree_stats* stats)
+{
+    tree->stats = stats;
+
+    tree->count = 0;
+    tree->capacity = 64;
+    tree->entries = (struct s_tree_entry*)malloc(tree->capacity * sizeof(struct s_tree_entry));
+
+    tree->ndirs = 0;
+    tree->nfiles = 0;
+    tree->bytes = 0;
+    tree->skipped = 0;
+
+    pthread_mutex_init(&tree->lock, NULL);
+    pthread_cond_init(&tree->ready, NULL);
+    pthread_cond_init(&tree->room, NULL);
+    tree->head = NULL;
+    tree->tail = NULL;
+    tree->inflight = 0;
+}
+
+void tree_del(struct s_tree* tree)
+{
+    uint32_t i;
+    for (i = 0; i < tree->count; ++i)
+        free(tree->entries[i].path);
+    free(tree->entries);
+
+    pthread_mutex_destroy(&tree->lock);
+    pthread_cond_destroy(&tree->ready);
+    pthread_cond_destroy(&tree->room);
+}
+
+char* tree_join(const char* dir, const char* name)
+{
+    uint32_t len = strlen(dir);
+    char* path = (char*)malloc(len + strlen(name) + 2);
+
+    strcpy(path, dir);
+    if (len == 0 || dir[len - 1] != '/')
+        strcat(path, "/");
+    strcat(path, name);
+
+    return path;
+}
+
+uint32_t tree_add(struct s_tree* tree, char* path, const char* name, uint32_t parent, char type, uint64_t size)
+{
+    if (tree->count == tree->capacity)
+    {
+        tree->capacity *= 2;
+        tree->entries = (struct s_tree_entry*)realloc(tree->entries, tree->capacity * sizeof(struct s_tree_entry));
+    }
+
+    struct s_tree_entry* e = tree->entries + tree->count;
+    e->path = path;
+    strncpy(e->name, name, NAME_LEN - 1);
+    e->name[NAME_LEN - 1] = 0;
+    e->parent = parent;
+    e->type = type;
+    e->size = size;
+    e->ninode = 0;
+    e->ifd = -1;
+    e->buf = NULL;
+    e->next = NULL;
+
+    if (type == 'd')
+        ++(tree->ndirs);
+    else
+    {
+        ++(tree->nfiles);
+        tree->bytes += size;
+    }
+
+    return tree->count++;
+}
+
+void tree_scan(struct s_tree* tree, uint32_t ndir)
+{
+    DIR* dir = opendir(tree->entries[ndir].path);
+    if (dir == NULL)
+    {
+        tree_report(tree->stats, tree->entries[ndir].path, -errno);
+        ++(tree->skipped);
+        return;
+    }
+
+    struct dirent* de;
+    struct stat st;
+
+    while ((de = readdir(dir)) != NULL)
+    {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+
+        char* path = tree_join(tree->entries[ndir].path, de->d_name);
+        int error = 0;
+        if (lstat(path, &st) == -1)
+            error = -errno;
+        else if (!(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)))
+            error = -ENOTSUP;
+        else if (strlen(de->d_name) >= NAME_LEN)
+            error = -ENAMETOOLONG;
+
+        if (error)
+        {
+            tree_report(tree->stats, path, error);
+            ++(tree->skipped);
+            free(path);
+            continue;
+        }
+
+        uint32_t i = tree_add(tree, path, de->d_name, ndir, S_ISDIR(st.st_mode) ? 'd' : '-', st.st_size);
+        if (S_ISDIR(st.st_mode))
+            tree_scan(tree, i);
+    }
+
+    closedir(dir);
+}
+
+int tree_fits(struct s_superblock* sb, struct s_tree* tree)
+{
+    uint32_t* nentries = (uint32_t*)calloc(tree->count, sizeof(uint32_t));
+    uint64_t blocks = 2, i;
+
+    for (i = 1; i < tree->count; ++i)
+    {
+        struct s_tree_entry* e = tree->entries + i;
+        ++nentries[e->parent];
+
+        if (e->type == '-')
+        {
+            uint64_t ndata = (e->size + sb->block_size - 1) / sb->block_size;
+            if (ndata > blockmap_get_capacity(sb) || e->size > UINT32_MAX - INODE_SIZE)
+            {
+                tree_report(tree->stats, e->path, -EFBIG);
+                free(nentries);
+                return -EFBIG;
+            }
+
+            blocks += ndata + blockmap_get_overhead(sb, ndata);
+        }
+    }
+
+    for (i = 0; i < tree->count; ++i)
+        if (nentries[i])
+            blocks += 1 + nentries[i] + blockmap_get_overhead(sb, 1 + nentries[i]);
+
+    free(nentries);
+
+    if (blocks > sb->blocks_remain)
+        return -ENOSPC;
+
+    if (tree->count > sb->inodes_remain)
+        return -ENFILE;
+
+    return 0;
+}
+
+uint64_t tree_get_charge(struct s_tree_entry* e)
+{
+    return e->size < TREE_BUFFER ? e->size : TREE_BUFFER;
+}
+
+void tree_read(struct s_pool* pool, uint32_t worker, void* arg)
+{
+    struct s_tree* tree = (struct s_tree*)pool->ctx;
+    struct s_tree_entry* e = (struct s_tree_entry*)arg;
+
+    pthread_mutex_lock(&tree->lock);
+    while (tree->inflight && tree->inflight + tree_get_charge(e) > TREE_INFLIGHT)
+        pthread_cond_wait(&tree->room, &tree->lock);
+    tree->inflight += tree_get_charge(e);
+    pthread_mutex_unlock(&tree->lock);
+
+    e->ifd = open(e->path, O_RDONLY);
+
+    if (e->ifd != -1 && e->size <= TREE_BUFFER)
+    {
+        e->buf = (uint8_t*)malloc(e->size ? e->size : 1);
+        if (io_read_full(e->ifd, e->buf, e->size) != (int64_t)e->size)
+        {
+            free(e->buf);
+            e->buf = NULL;
+        }
+
+        close(e->ifd);
+        e->ifd = -1;
+    }
+    else if (e->ifd != -1)
+        posix_fadvise(e->ifd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    pthread_mutex_lock(&tree->lock);
+    if (tree->tail)
+        tree->tail->next = e;
+    else
+        tree->head = e;
+    tree->tail = e;
+    pthread_cond_signal(&tree->ready);
+    pthread_mutex_unlock(&tree->lock);
+}
+
+struct s_tree_entry* tree_next(struct s_tree* tree)
+{
+    pthread_mutex_lock(&tree->lock);
+    while (tree->head == NULL)
+        pthread_cond_wait(&tree->ready, &tree->lock);
+
+    struct s_tree_entry* e = tree->head;
+    tree->head = e->next;
+    if (tree->head == NULL)
+        tree->tail = NULL;
+    pthread_mutex_unlock(&tree->lock);
+
+    return e;
+}
+
+void tree_done(struct s_tree* tree, struct s_tree_entry* e)
+{
+    if (e->ifd != -1)
+        close(e->ifd);
+    free(e->buf);
+
+    e->ifd = -1;
+    e->buf = NULL;
+
+    pthread_mutex_lock(&tree->lock);
+    tree->inflight -= tree_get_charge(e);
+    pthread_cond_broadcast(&tree->room);
+    pthread_mutex_unlock(&tree->lock);
+}
+
+int fs_pull_tree(struct s_superblock* sb, int fd, struct s_inode* node, const char* from, const char* to, struct s_tree_stats* stats)
+{
+    struct stat st;
+    if (stat(from, &st) == -1)
+        return -errno;
+    if (!S_ISDIR(st.st_mode))
+        return -ENOTDIR;
+
+    if (fs_find_ninode(sb, fd, node, to))
+        return -EEXIST;
+
+    uint64_t start = get_time_ns();
+
+    struct s_tree tree;
+    tree_init(&tree, stats);
+
+    char* path = (char*)malloc(strlen(from) + 1);
+    strcpy(path, from);
+    tree_add(&tree, path, to, TREE_ROOT, 'd', 0);
+    tree_scan(&tree, 0);
+
+    int status = tree_fits(sb, &tree);
+    if (status != 0)
+    {
+        tree_del(&tree);
+        return status;
+    }
+
+    struct s_inode* dir;
+    inode_init(&dir, 0, 0, "", 0);
+
+    uint32_t i, failed = 0;
+
+    // directories first: the scan put every parent before its children
+    for (i = 0; i < tree.count; ++i)
+    {
+        struct s_tree_entry* e = tree.entries + i;
+        if (e->type != 'd')
+            continue;
+
+        if (e->parent == TREE_ROOT)
+            status = fs_make_dir(sb, fd, node, e->name, &e->ninode);
+        else if (tree.entries[e->parent].ninode)
+        {
+            inode_read(dir, sb, fd, tree.entries[e->parent].ninode);
+            status = fs_make_dir(sb, fd, dir, e->name, &e->ninode);
+        }
+        else
+            continue;
+
+        if (status != 0)
+        {
+            if (i == 0)
+                break;
+
+            tree_report(stats, e->path, status);
+            ++failed;
+            e->ninode = 0;
+        }
+
+        // every object is an operation of its own as far as the journal
+        // goes, so a big tree is committed in whole steps
+        if (journal_is_full(sb))
+            fs_sync(sb, fd);
+    }
+
+    if (tree.entries[0].ninode == 0)
+    {
+        inode_del(dir);
+        tree_del(&tree);
+        return status;
+    }
+
+    struct s_pool* pool;
+    pool_init(&pool, pool_get_ncpus(), tree_read, &tree);
+
+    uint32_t nfiles = 0;
+    for (i = 0; i < tree.count; ++i)
+    {
+        struct s_tree_entry* e = tree.entries + i;
+        if (e->type == '-' && tree.entries[e->parent].ninode)
+            pool_push(pool, nfiles++, e);
+        else if (e->type == '-')
+            ++failed;
+    }
+
+    pool_start(pool);
+
+    for (i = 0; i < nfiles; ++i)
+    {
+        struct s_tree_entry* e = tree_next(&tree);
+
+        if (e->buf == NULL && e->ifd == -1)
+            status = -EIO;
+        else
+        {
+            inode_read(dir, sb, fd, tree.entries[e->parent].ninode);
+            int64_t n = fs_pull_data(sb, fd, dir, e->name, e->size, e->ifd, e->buf);
+            status = n < 0 ? n : 0;
+
+            // the file shrank since the scan: not what was asked for, drop it
+            if (n >= 0 && (uint64_t)n != e->size)
+            {
+                fs_remove(sb, fd, dir, e->name);
+                status = -EIO;
+            }
+        }
+
+        if (status != 0)
+        {
+            tree_report(stats, e->path, status);
+            ++failed;
+        }
+
+        tree_done(&tree, e);
+
+        if (journal_is_full(sb))
+            fs_sync(sb, fd);
+    }
+
+    pool_wait(pool);
+    pool_del(pool);
+
+    stats->ndirs = tree.ndirs;
+    stats->nfiles = tree.nfiles;
+    stats->bytes = tree.bytes;
+    stats->failed = failed;
+    stats->skipped = tree.skipped;
+    stats->ns = get_time_ns() - start;
+
+    inode_del(dir);
+    tree_del(&tree);
+
+    return 0;
+}
+
+struct timespec tree_get_time(uint64_t ns)
+{
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    return ts;
+}
+
+void tree_export_fail(struct s_tree_export* ex, const char* path, int error)
+{
+    pthread_mutex_lock(&ex->lock);
+    tree_report(ex->stats, path, error);
+    ++(ex->failed);
+    pthread_mutex_unlock(&ex->lock);
+}
+
+void tree_write(struct s_pool* pool, uint32_t worker, void* arg)
+{
+    struct s_tree_export* ex = (struct s_tree_export*)pool->ctx;
+    struct s_tree_file* f = (struct s_tree_file*)arg;
+
+    int ofd = open(f->path, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    if (ofd == -1)
+        tree_export_fail(ex, f->path, -errno);
+    else
+    {
+        if (!io_blocks_to(&ex->view, ex->fd, ofd, f->blocks, f->n, f->len))
+            tree_export_fail(ex, f->path, -EIO);
+
+        struct timespec times[2];
+        times[0].tv_sec = 0;
+        times[0].tv_nsec = UTIME_OMIT;
+        times[1] = tree_get_time(f->mtime);
+        futimens(ofd, times);
+
+        close(ofd);
+    }
+
+    free(f->path);
+    free(f->blocks);
+    free(f);
+}
+
+void tree_export_dir(struct s_superblock* sb, int fd, struct s_tree_export* ex, struct s_pool* pool, struct s_inode* node, const char* path)
+{
+    if (node->nblocks == 0)
+        return;
+
+    uint8_t* block = (uint8_t*)malloc(sb->block_size);
+    uint32_t nblock, off, end;
+    struct s_dirent de;
+
+    struct s_inode* child;
+    inode_init(&child, 0, 0, "", 0);
+
+    struct s_blockmap it;
+    blockmap_init(&it, sb, fd, node, 1);
+
+    while ((nblock = blockmap_next(&it)) != 0)
+    {
+        cache_pread(sb, fd, block, sb->block_size, get_block_offset(sb, nblock));
+
+        end = DIR_BUCKET_HEAD + inode_get32(block + 4);
+        for (off = DIR_BUCKET_HEAD; off < end; )
+        {
+            off += fs_dirent_decode(&de, block + off);
+
+            char* host = tree_join(path, de.name);
+            inode_read(child, sb, fd, de.ninode);
+
+            if (child->type == 'd')
+            {
+                if (mkdir(host, 0777) == -1)
+                {
+                    tree_export_fail(ex, host, -errno);
+                    free(host);
+                    continue;
+                }
+
+                if (ex->dirs_count == ex->dirs_capacity)
+                {
+                    ex->dirs_capacity = ex->dirs_capacity ? 2 * ex->dirs_capacity : 64;
+                    ex->dirs = (struct s_tree_file*)realloc(ex->dirs, ex->dirs_capacity * sizeof(struct s_tree_file));
+                }
+                ex->dirs[ex->dirs_count].path = host;
+                ex->dirs[ex->dirs_count++].mtime = child->mtime;
+                ++(ex->ndirs);
+
+                struct s_inode* dir;
+                inode_init(&dir, 0, 0, "", 0);
+                inode_copy(dir, child);
+                tree_export_dir(sb, fd, ex, pool, dir, host);
+                inode_del(dir);
+                continue;
+            }
+
+            struct s_tree_file* f = (struct s_tree_file*)malloc(sizeof(struct s_tree_file));
+            f->path = host;
+            f->blocks = blockmap_collect(sb, fd, child);
+            f->n = child->nblocks;
+            f->len = child->size - INODE_SIZE;
+            f->mtime = child->mtime;
+
+            // f belongs to the writers from here on
+            ex->bytes += f->len;
+            pool_push(pool, ex->nfiles++, f);
+
+            child->atime = get_time_ns();
+            inode_write(child, sb, fd, child->ninode);
+
+            if (journal_is_full(sb))
+                fs_sync(sb, fd);
+        }
+    }
+
+    blockmap_del(&it);
+    inode_del(child);
+    free(block);
+}
+
+int fs_push_tree(struct s_superblock* sb, int fd, struct s_inode* dir, const char* to, struct s_tree_stats* stats)
+{
+    if (dir->type != 'd')
+        return -ENOTDIR;
+
+    if (mkdir(to, 0777) == -1)
+        return -errno;
+
+    uint64_t start = get_time_ns();
+
+    struct s_tree_export ex;
+    ex.view = *sb;
+    ex.view.cache = NULL;
+    ex.view.io = NULL;
+    if (sb->io)
+    {
+        ex.io = *sb->io;
+        ex.io.ring = NULL;
+        ex.view.io = &ex.io;
+    }
+    ex.fd = fd;
+    ex.ndirs = 0;
+    ex.nfiles = 0;
+    ex.bytes = 0;
+    ex.failed = 0;
+    ex.dirs = NULL;
+    ex.dirs_count = 0;
+    ex.dirs_capacity = 0;
+    ex.stats = stats;
+    pthread_mutex_init(&ex.lock, NULL);
+
+    struct s_pool* pool;
+    pool_init(&pool, pool_get_ncpus(), tree_write, &ex);
+    pool_start(pool);
+
+    tree_export_dir(sb, fd, &ex, pool, dir, to);
+
+    pool_wait(pool);
+    pool_del(pool);
+
+    uint32_t i;
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+
+    for (i = 0; i < ex.dirs_count; ++i)
+    {
+        times[1] = tree_get_time(ex.dirs[i].mtime);
+        utimensat(AT_FDCWD, ex.dirs[i].path, times, 0);
+        free(ex.dirs[i].path);
+    }
+    times[1] = tree_get_time(dir->mtime);
+    utimensat(AT_FDCWD, to, times, 0);
+    free(ex.dirs);
+
+    pthread_mutex_destroy(&ex.lock);
+
+    stats->ndirs = ex.ndirs + 1;
+    stats->nfiles = ex.nfiles;
+    stats->bytes = ex.bytes;
+    stats->failed = ex.failed;
+    stats->skipped = 0;
+    stats->ns = get_time_ns() - start;
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+#ifndef TREE_H_INCLUDED
+#define TREE_H_INCLUDED
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "superblock.h"
+#include "inode.h"
+#include "blockmap.h"
+#include "pool.h"
+#include "io.h"
+#include "utils.h"
+#include "fs.h"
+
+// Files up to this size are read into memory by the reader threads, larger
+// ones are copied by the writer straight from the host file.
+#define TREE_BUFFER 4194304
+// At most this many bytes of file data are read ahead of the writer.
+#define TREE_INFLIGHT 67108864
+
+#define TREE_ROOT UINT32_MAX
+
+// Outcome of pull -r and push -r. report, when set, is told about every
+// object that was skipped or could not be copied; push -r calls it from its
+// writer threads, but never from two at once.
+struct s_tree_stats
+{
+    uint32_t ndirs;
+    uint32_t nfiles;
+    uint64_t bytes;
+    uint32_t failed;
+    uint32_t skipped;
+    uint64_t ns;
+
+    void (*report)(void* arg, const char* path, int error);
+    void* arg;
+};
+
+void tree_report(struct s_tree_stats* stats, const char* path, int error);
+
+// pull -r: recursive import of a host directory tree. The tree is scanned first,
+// directories before their contents, so the space and inodes it needs are
+// known before anything is allocated. The writer (the calling thread)
+// creates every directory, then a pool of reader threads opens and reads
+// the files while the writer takes them in the order they complete and does
+// all allocation and metadata updates alone, so the image is only ever
+// touched from one thread.
+struct s_tree_entry
+{
+    char* path;
+    char name[NAME_LEN];
+    uint32_t parent;
+    char type;
+    uint64_t size;
+
+    uint32_t ninode;
+
+    int ifd;
+    uint8_t* buf;
+    struct s_tree_entry* next;
+};
+
+struct s_tree
+{
+    struct s_tree_stats* stats;
+
+    struct s_tree_entry* entries;
+    uint32_t count;
+    uint32_t capacity;
+
+    uint32_t ndirs;
+    uint32_t nfiles;
+    uint64_t bytes;
+    uint32_t skipped;
+
+    // files the readers are done with, in completion order
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t room;
+    struct s_tree_entry* head;
+    struct s_tree_entry* tail;
+    uint64_t inflight;
+};
+
+void tree_init(struct s_tree* tree, struct s_tree_stats* stats);
+
+void tree_del(struct s_tree* tree);
+
+char* tree_join(const char* dir, const char* name);
+
+uint32_t tree_add(struct s_tree* tree, char* path, const char* name, uint32_t parent, char type, uint64_t size);
+
+// Adds the contents of directory entry ndir, recursively. Anything but
+// regular files and directories is skipped, as are names too long to store.
+void tree_scan(struct s_tree* tree, uint32_t ndir);
+
+// Checks the blocks and inodes the whole tree needs at most: the data and
+// index blocks of every file, and for every directory its hash index plus
+// one bucket per entry, since entries may all land in different chains.
+int tree_fits(struct s_superblock* sb, struct s_tree* tree);
+
+// What a file counts against TREE_INFLIGHT while it waits for the writer;
+// large files only hold an open descriptor, but are still limited.
+uint64_t tree_get_charge(struct s_tree_entry* e);
+
+// Reader: opens the file and, if it is small, reads all of it; a file that
+// no longer has the length the scan found fails. Blocks while the writer is
+// too far behind.
+void tree_read(struct s_pool* pool, uint32_t worker, void* arg);
+
+struct s_tree_entry* tree_next(struct s_tree* tree);
+
+void tree_done(struct s_tree* tree, struct s_tree_entry* e);
+
+// pull -r: imports the host directory from as new directory to of node.
+// Objects that fail on their own, files that shrank since the scan among
+// them, are counted in stats and left out; the call only fails when nothing
+// could be imported.
+int fs_pull_tree(struct s_superblock* sb, int fd, struct s_inode* node, const char* from, const char* to, struct s_tree_stats* stats);
+
+// push -r: the calling thread walks the image subtree through the cache,
+// creates the host directories and queues every file with its block list;
+// a pool of writer threads streams the files out. The writers see the image
+// through a copy of the superblock without the cache and the io_uring,
+// both of which belong to the calling thread, so they only ever issue plain
+// pread/sendfile or copy from the mapping.
+struct s_tree_file
+{
+    char* path;
+    uint32_t* blocks;
+    uint32_t n;
+    uint64_t len;
+    uint64_t mtime;
+};
+
+struct s_tree_export
+{
+    struct s_superblock view;
+    struct s_io io;
+    int fd;
+
+    uint32_t ndirs;
+    uint32_t nfiles;
+    uint64_t bytes;
+    uint32_t failed;
+
+    struct s_tree_stats* stats;
+    pthread_mutex_t lock;
+
+    // host directories get their times once everything below is written
+    struct s_tree_file* dirs;
+    uint32_t dirs_count;
+    uint32_t dirs_capacity;
+};
+
+struct timespec tree_get_time(uint64_t ns);
+
+void tree_export_fail(struct s_tree_export* ex, const char* path, int error);
+
+void tree_write(struct s_pool* pool, uint32_t worker, void* arg);
+
+void tree_export_dir(struct s_superblock* sb, int fd, struct s_tree_export* ex, struct s_pool* pool, struct s_inode* node, const char* path);
+
+// push -r: exports directory dir as the new host directory to.
+int fs_push_tree(struct s_superblock* sb, int fd, struct s_inode* dir, const char* to, struct s_tree_stats* stats);
+
+#endif // TREE_H_INCLUDED
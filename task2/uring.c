@@ -0,0 +1,145 @@
+#include "uring.h"
+
+int uring_init(struct s_uring** ring, uint32_t entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(struct io_uring_params));
+
+    int fd = syscall(SYS_io_uring_setup, entries, &p);
+    if (fd < 0)
+        return 0;
+
+    struct s_uring* r = (struct s_uring*)calloc(1, sizeof(struct s_uring));
+    r->fd = fd;
+    r->entries = p.sq_entries;
+
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_size > r->sq_size)
+            r->sq_size = r->cq_size;
+        r->cq_size = 0;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    r->cq_ring = r->cq_size ? mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING) : r->sq_ring;
+    void* sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        if (r->sq_ring != MAP_FAILED)
+            munmap(r->sq_ring, r->sq_size);
+        if (r->cq_size && r->cq_ring != MAP_FAILED)
+            munmap(r->cq_ring, r->cq_size);
+        if (sqes != MAP_FAILED)
+            munmap(sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+
+        close(fd);
+        free(r);
+        return 0;
+    }
+
+    uint8_t* sq = (uint8_t*)r->sq_ring;
+    r->sq_head = (uint32_t*)(sq + p.sq_off.head);
+    r->sq_tail = (uint32_t*)(sq + p.sq_off.tail);
+    r->sq_mask = (uint32_t*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (uint32_t*)(sq + p.sq_off.array);
+    r->sqes = (struct io_uring_sqe*)sqes;
+
+    uint8_t* cq = (uint8_t*)r->cq_ring;
+    r->cq_head = (uint32_t*)(cq + p.cq_off.head);
+    r->cq_tail = (uint32_t*)(cq + p.cq_off.tail);
+    r->cq_mask = (uint32_t*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    *ring = r;
+    return 1;
+}
+
+void uring_del(struct s_uring* ring)
+{
+    munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+    if (ring->cq_size)
+        munmap(ring->cq_ring, ring->cq_size);
+    munmap(ring->sq_ring, ring->sq_size);
+
+    close(ring->fd);
+    free(ring);
+}
+
+void uring_reap(struct s_uring* ring)
+{
+    uint32_t head = *ring->cq_head;
+    uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head)
+    {
+        struct io_uring_cqe* cqe = ring->cqes + (head & *ring->cq_mask);
+        if (cqe->res < 0 || (uint64_t)cqe->res != cqe->user_data)
+            ring->failed = 1;
+
+        --(ring->inflight);
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+int uring_submit(struct s_uring* ring, uint32_t wait_nr)
+{
+    for (;;)
+    {
+        int n = syscall(SYS_io_uring_enter, ring->fd, ring->queued, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n >= 0)
+        {
+            ring->queued -= n;
+            break;
+        }
+
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            ring->failed = 1;
+            return 0;
+        }
+    }
+
+    uring_reap(ring);
+    return 1;
+}
+
+int uring_queue(struct s_uring* ring, uint8_t op, int fd, void* buf, uint32_t len, uint64_t offset)
+{
+    while (ring->inflight == ring->entries)
+        if (!uring_submit(ring, 1))
+            return 0;
+
+    uint32_t tail = *ring->sq_tail;
+    uint32_t i = tail & *ring->sq_mask;
+
+    struct io_uring_sqe* sqe = ring->sqes + i;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = len;
+
+    ring->sq_array[i] = i;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    ++(ring->queued);
+    ++(ring->inflight);
+    return 1;
+}
+
+int uring_wait(struct s_uring* ring)
+{
+    while (ring->inflight)
+        if (!uring_submit(ring, ring->inflight))
+            break;
+
+    int ok = !ring->failed;
+    ring->failed = 0;
+    return ok;
+}
@@ -0,0 +1,61 @@
+#ifndef URING_H_INCLUDED
+#define URING_H_INCLUDED
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 256
+
+// Minimal io_uring driver on top of the raw system calls. Reads and writes
+// are put on the submission ring and handed to the kernel in one
+// io_uring_enter call once the ring fills up or uring_wait is called, which
+// also reaps every completion. A request that transfers less than it asked
+// for marks the ring as failed until the next uring_wait.
+struct s_uring
+{
+    int fd;
+    uint32_t entries;
+
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t* sq_mask;
+    uint32_t* sq_array;
+    struct io_uring_sqe* sqes;
+
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_size;
+    void* cq_ring;
+    size_t cq_size;
+
+    uint32_t queued;
+    uint32_t inflight;
+    int failed;
+};
+
+int uring_init(struct s_uring** ring, uint32_t entries);
+
+void uring_del(struct s_uring* ring);
+
+void uring_reap(struct s_uring* ring);
+
+// Submits everything queued and blocks until at least wait_nr requests
+// have completed. Returns 0 if the kernel refused the ring altogether.
+int uring_submit(struct s_uring* ring, uint32_t wait_nr);
+
+int uring_queue(struct s_uring* ring, uint8_t op, int fd, void* buf, uint32_t len, uint64_t offset);
+
+// Waits for every queued request; returns 0 if any of them failed.
+int uring_wait(struct s_uring* ring);
+
+#endif // URING_H_INCLUDED
@@ -0,0 +1,21 @@
+#include "utils.h"
+
+uint8_t log2_ceil(uint32_t n)
+{
+    uint8_t i;
+    for (i = 0; n; ++i)
+        n >>= 1;
+    return i;
+}
+
+uint64_t get_block_offset(struct s_superblock* sb, uint32_t nblock)
+{
+    return (uint64_t)nblock * sb->block_size;
+}
+
+uint64_t get_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -7,19 +7,14 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <ctype.h>
+#include <time.h>
 
-uint8_t log2_ceil(uint32_t n)
-{
-    uint8_t i;
-    for (i = 0; n; ++i)
-        n >>= 1;
-    return i;
-}
+uint8_t log2_ceil(uint32_t n);
 
-uint32_t get_block_offset(struct s_superblock* sb, uint32_t nblock)
-{
-    return nblock * sb->block_size;
-}
+uint64_t get_block_offset(struct s_superblock* sb, uint32_t nblock);
+
+// Wall clock time in nanoseconds since the epoch.
+uint64_t get_time_ns();
 
 #define mod_base2(n, base2) (n & (base2 - 1))
 #define get8_bit(n, nbit) (n & (1 << (8 - nbit - 1)))